@@ -16,6 +16,11 @@
 #include <linux/if_packet.h>
 #include <sys/socket.h>
 #include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -23,12 +28,23 @@
 #include <net/if_arp.h>
 #include <netinet/in.h>
 #include <netinet/udp.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sched.h>
 #include <poll.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <limits.h>
+#include <ifaddrs.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <math.h>
+#include <endian.h>
 
 #define TXMINBUF	2048
 #define RXMINBUF	256
@@ -36,6 +52,250 @@
 #define RXRING		64
 #define RXTXBUF		2097152
 #define DATASIZE	64
+#define MAXCLASS	8
+#define MAXSLO		8
+#define MAXRESP		32
+#define MAXSTATS	(MAXRESP+1)
+#define MAXFLOW		256
+#define LOADRING	256
+#define LOADBATCH	64
+#define LOADPORT	9
+#define ETH_P_LOAD	0x88b6
+#define CAPBUF		1048576
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW	101
+#define REPRING		65536
+#define HUGEPAGE	(2*1024*1024)
+
+#define HISTBITS	5
+#define HISTSUB		(1<<HISTBITS)
+#define HISTMAX		30
+#define HISTSIZE	((HISTMAX-HISTBITS+1)*HISTSUB)
+
+#define HISTMAGIC	"NDHIST\0\1"
+#define HRECHDR		124
+
+#define REP_SAMPLE	0
+#define REP_LOST	1
+#define REP_PRINT	2
+#define REP_AUX		3
+
+#define TXPROBES	16
+#define MAXPEER		16
+#define REPLAYWIN	4096
+#define MAXSESS		1024
+#define TP_STATUS_TS	(TP_STATUS_TS_SOFTWARE|TP_STATUS_TS_SYS_HARDWARE|\
+			 TP_STATUS_TS_RAW_HARDWARE)
+
+#define PROBE_PRIO	0x01
+#define PROBE_DSCP	0x02
+
+/* linux 6.9 epoll busy poll parameters, missing in older headers */
+#ifndef EPIOCSPARAMS
+struct epoll_params
+{
+	uint32_t busy_poll_usecs;
+	uint16_t busy_poll_budget;
+	uint8_t prefer_busy_poll;
+	uint8_t pad;
+};
+
+#define EPIOCSPARAMS	_IOW(0x8a,0x01,struct epoll_params)
+#endif
+
+struct probe
+{
+	struct timespec ts;
+	uint32_t seq;
+	uint8_t cls;
+	uint8_t flags;
+	uint8_t prio;
+	uint8_t dscp;
+	uint64_t spare;
+};
+
+struct slo
+{
+	double pct;
+	uint64_t val;
+};
+
+struct stats
+{
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	uint64_t n;
+	uint64_t lost;
+	uint64_t hist[HISTSIZE];
+};
+
+struct hrec
+{
+	char name[16];
+	char info[64];
+	struct stats st;
+};
+
+struct load
+{
+	struct rxtx *tx;
+	int us;
+	int rate;
+	int size;
+	int tag;
+	int vid;
+	unsigned char src[ETH_ALEN];
+	unsigned char dst[ETH_ALEN];
+	struct sockaddr_storage ss;
+	uint64_t pkts;
+	uint64_t bytes;
+	uint64_t lpkts;
+	uint64_t lbytes;
+	struct timespec last;
+};
+
+struct pcap
+{
+	FILE *fp;
+	int udp;
+	int family;
+	int tos;
+	uint64_t thresh;
+	int64_t off;
+	uint64_t drop;
+	size_t len;
+	unsigned char lip[16];
+	unsigned char rip[16];
+	unsigned char bfr[CAPBUF] __attribute__((aligned(8)));
+};
+
+struct shm
+{
+	uint32_t req __attribute__((aligned(64)));
+	uint32_t ack __attribute__((aligned(64)));
+};
+
+struct txsched
+{
+	uint64_t next;
+	uint64_t lead;
+	uint64_t period;
+	int local;
+};
+
+struct txprobe
+{
+	uint64_t sent;
+	uint64_t sched;
+	uint64_t snd;
+	uint64_t hw;
+	uint32_t id;
+};
+
+struct txstamp
+{
+	uint32_t id;
+	struct txprobe p[TXPROBES];
+	struct stats st[3];
+};
+
+struct rpeer
+{
+	struct sockaddr_storage ss;
+	uint64_t n;
+	uint64_t last;
+};
+
+struct rstat
+{
+	uint64_t refl;
+	uint64_t full;
+	uint64_t nobufs;
+	uint64_t err;
+	uint64_t wake;
+	uint64_t frames;
+	uint64_t bmax;
+	uint64_t other;
+	uint64_t lrefl;
+	uint64_t lother;
+	uint64_t last;
+	uint64_t next;
+	uint64_t period;
+	int npeer;
+	struct rpeer peer[MAXPEER];
+	struct stats turn;
+};
+
+struct tpkt
+{
+	uint64_t at;
+	uint32_t len;
+};
+
+struct meas
+{
+	int pre;
+	int chg;
+	int ts;
+	int cont;
+	uint64_t n;
+	uint64_t mask;
+	int nst;
+};
+
+struct rslot
+{
+	uint64_t sent;
+	uint32_t seq;
+};
+
+struct replay
+{
+	struct tpkt *pkt;
+	struct stats *st;
+	int n;
+	uint32_t seq;
+	struct meas m;
+	struct rslot win[REPLAYWIN];
+};
+
+struct session
+{
+	int fd;
+	int hidx;
+	uint32_t seq;
+	uint64_t period;
+	uint64_t next;
+	uint64_t sent;
+	struct stats *st;
+	char name[48];
+};
+
+struct repent
+{
+	struct stats *s;
+	uint64_t val;
+	int type;
+};
+
+struct report
+{
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t ctail;
+	uint64_t tail __attribute__((aligned(64)));
+	int done __attribute__((aligned(64)));
+	int ts;
+	int cont;
+	struct repent ring[REPRING] __attribute__((aligned(64)));
+};
+
+struct geom
+{
+	int frames;
+	int block;
+	int buf;
+};
 
 struct rxtx
 {
@@ -50,11 +310,39 @@ struct rxtx
 	int size;
 	int doff;
 	int hoff;
+	int fsize;
+	int bsize;
 	unsigned char *map;
 	unsigned char *data[0];
 };
 
-static struct rxtx *rxopen(char *dev,int proto,int bpoll)
+/* the kernel inserts all ring pages at mmap time, so there is nothing
+   left to prefault */
+static void *ringmap(int fd,int size)
+{
+	void *map;
+
+	if((map=mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0))==
+		MAP_FAILED)return NULL;
+	return map;
+}
+
+static void geomshow(char *name,struct rxtx *r)
+{
+	int rb=0;
+	int sb=0;
+	socklen_t sl=sizeof(int);
+
+	getsockopt(r->fd,SOL_SOCKET,SO_RCVBUF,&rb,&sl);
+	sl=sizeof(int);
+	getsockopt(r->fd,SOL_SOCKET,SO_SNDBUF,&sb,&sl);
+	fprintf(stderr,"%s ring: %d frames of %d bytes in %d blocks of %d bytes, "
+		"%d pages mapped, rcvbuf %d sndbuf %d\n",name,r->total,r->fsize,
+		r->size/r->bsize,r->bsize,r->size/(int)sysconf(_SC_PAGESIZE),rb,
+		sb);
+}
+
+static struct rxtx *rxopen(char *dev,int proto,int bpoll,struct geom *g)
 {
 	int fd;
 	int parm;
@@ -79,8 +367,7 @@ static struct rxtx *rxopen(char *dev,int proto,int bpoll)
 	if(setsockopt(fd,SOL_PACKET,PACKET_IGNORE_OUTGOING,&parm,sizeof(parm)))
 		goto err2;
 #endif
-	parm=RXTXBUF;
-	if(setsockopt(fd,SOL_SOCKET,SO_RCVBUFFORCE,&parm,sizeof(parm)))
+	if(setsockopt(fd,SOL_SOCKET,SO_RCVBUFFORCE,&g->buf,sizeof(g->buf)))
 		goto err2;
 	parm=TXMINBUF;
 	if(setsockopt(fd,SOL_SOCKET,SO_SNDBUFFORCE,&parm,sizeof(parm)))
@@ -91,11 +378,11 @@ static struct rxtx *rxopen(char *dev,int proto,int bpoll)
 	memset(&req,0,sizeof(req));
 	req.tp_frame_size=TPACKET_ALIGN(TPACKET2_HDRLEN+ETH_HLEN)+
 		TPACKET_ALIGN(DATASIZE);
-	req.tp_block_size=sysconf(_SC_PAGESIZE);
+	req.tp_block_size=g->block?g->block:sysconf(_SC_PAGESIZE);
 	while(req.tp_block_size<req.tp_frame_size)req.tp_block_size<<=1;
 	parm=req.tp_block_size/req.tp_frame_size;
-	req.tp_block_nr=RXRING/parm;
-	while(req.tp_block_nr*parm<RXRING)req.tp_block_nr++;
+	req.tp_block_nr=g->frames/parm;
+	while(req.tp_block_nr*parm<g->frames)req.tp_block_nr++;
 	req.tp_frame_nr=req.tp_block_nr*parm;
 	if(setsockopt(fd,SOL_PACKET,PACKET_RX_RING,&req,sizeof(req)))goto err2;
 
@@ -105,11 +392,12 @@ static struct rxtx *rxopen(char *dev,int proto,int bpoll)
 	rx->index=0;
 	rx->total=req.tp_frame_nr;
 	rx->size=req.tp_block_nr*req.tp_block_size;
+	rx->fsize=req.tp_frame_size;
+	rx->bsize=req.tp_block_size;
 	rx->doff=TPACKET_ALIGN(TPACKET2_HDRLEN+ETH_HLEN);
 	rx->hoff=rx->doff-ETH_HLEN;
 
-	if(!(rx->map=mmap(NULL,rx->size,PROT_READ|PROT_WRITE,MAP_SHARED,
-		rx->fd,0)))goto err3;
+	if(!(rx->map=ringmap(rx->fd,rx->size)))goto err3;
 
 	for(i=0;i<req.tp_frame_nr;i++)
 		rx->data[i]=rx->map+(i/parm)*req.tp_block_size+(i%parm)*
@@ -129,7 +417,20 @@ static void rxclose(struct rxtx *rx)
 	free(rx);
 }
 
-static struct rxtx *txopen(char *dev)
+static volatile sig_atomic_t stop=0;
+static uint64_t limit=0;
+static struct load *lgen=NULL;
+static struct pcap *cap=NULL;
+static struct report *rep=NULL;
+static char label[MAXSTATS][24];
+static struct txstamp *tstx=NULL;
+static struct rstat *rst=NULL;
+static struct session *sess=NULL;
+static int nsess=0;
+static volatile sig_atomic_t dump=0;
+static char *txname[3]={"qdisc","driver","wire"};
+
+static struct rxtx *txopen(char *dev,int size,struct geom *g)
 {
 	int fd;
 	int parm;
@@ -157,18 +458,17 @@ static struct rxtx *txopen(char *dev)
 	parm=RXMINBUF;
 	if(setsockopt(fd,SOL_SOCKET,SO_RCVBUFFORCE,&parm,sizeof(parm)))
 		goto err2;
-	parm=RXTXBUF;
-	if(setsockopt(fd,SOL_SOCKET,SO_SNDBUFFORCE,&parm,sizeof(parm)))
+	if(setsockopt(fd,SOL_SOCKET,SO_SNDBUFFORCE,&g->buf,sizeof(g->buf)))
 		goto err2;
 
 	memset(&req,0,sizeof(req));
 	req.tp_frame_size=TPACKET_ALIGN(TPACKET2_HDRLEN)+
-		TPACKET_ALIGN(DATASIZE);
-	req.tp_block_size=sysconf(_SC_PAGESIZE);
+		TPACKET_ALIGN(size);
+	req.tp_block_size=g->block?g->block:sysconf(_SC_PAGESIZE);
 	while(req.tp_block_size<req.tp_frame_size)req.tp_block_size<<=1;
 	parm=req.tp_block_size/req.tp_frame_size;
-	req.tp_block_nr=TXRING/parm;
-	while(req.tp_block_nr*parm<TXRING)req.tp_block_nr++;
+	req.tp_block_nr=g->frames/parm;
+	while(req.tp_block_nr*parm<g->frames)req.tp_block_nr++;
 	req.tp_frame_nr=req.tp_block_nr*parm;
 	if(setsockopt(fd,SOL_PACKET,PACKET_TX_RING,&req,sizeof(req)))goto err2;
 
@@ -179,11 +479,12 @@ static struct rxtx *txopen(char *dev)
 	tx->tail=0;
 	tx->total=req.tp_frame_nr;
 	tx->size=req.tp_block_nr*req.tp_block_size;
+	tx->fsize=req.tp_frame_size;
+	tx->bsize=req.tp_block_size;
 	tx->hoff=TPACKET2_HDRLEN-sizeof(struct sockaddr_ll);
 	tx->doff=tx->hoff+ETH_HLEN;
 
-	if(!(tx->map=mmap(NULL,tx->size,PROT_READ|PROT_WRITE,MAP_SHARED,
-		tx->fd,0)))goto err3;
+	if(!(tx->map=ringmap(tx->fd,tx->size)))goto err3;
 
 	for(i=0;i<req.tp_frame_nr;i++)
 		tx->data[i]=tx->map+(i/parm)*req.tp_block_size+(i%parm)*
@@ -211,13 +512,16 @@ static int mksock(int family,int proto,int port,char *dev,int dscp,int prio,
 	struct sockaddr_in a;
 	struct sockaddr_in6 a6;
 
-	if((s=socket(family,SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC,
-		proto?IPPROTO_UDPLITE:0))==-1)goto err1;
+	if((s=socket(family,(proto==2?SOCK_STREAM:SOCK_DGRAM)|SOCK_NONBLOCK|
+		SOCK_CLOEXEC,proto==1?IPPROTO_UDPLITE:0))==-1)goto err1;
 	i=1;
-	if(setsockopt(s,SOL_SOCKET,SO_REUSEADDR,&i,sizeof(i)))
+	/* ephemeral ports must stay unique, e.g. for many sessions */
+	if(port)if(setsockopt(s,SOL_SOCKET,SO_REUSEADDR,&i,sizeof(i)))
 		goto err2;
 	if(bpoll)if(setsockopt(s,SOL_SOCKET,SO_BUSY_POLL,&bpoll,sizeof(bpoll)))
 		goto err2;
+	if(proto==2)if(setsockopt(s,IPPROTO_TCP,TCP_NODELAY,&i,sizeof(i)))
+		goto err2;
 
 	if(cpu!=-1)if(setsockopt(s,SOL_SOCKET,SO_INCOMING_CPU,&cpu,sizeof(cpu)))
 		goto err2;
@@ -274,598 +578,4203 @@ err2:	close(s);
 err1:	return -1;
 }
 
-static void l2initiator(struct rxtx *tx,struct rxtx *rx,void *src,void *dst,
-	int prio,int vid,int ts,int dly,int cont,int fast)
+static int getcls(char *list,int *cls)
 {
-	struct tpacket2_hdr *rxhdr;
-	struct tpacket2_hdr *txhdr;
-	struct ethhdr *txe;
-	struct timespec *data;
-	int curr;
-	int next;
-	int pre=20;
-	int rep;
+	int n=0;
+	char *end;
+
+	while(1)
+	{
+		if(n==MAXCLASS||*list<'0'||*list>'9')return -1;
+		cls[n]=strtol(list,&end,10);
+		if(cls[n++]>63)return -1;
+		if(!*end)return n;
+		if(*end!=',')return -1;
+		list=end+1;
+	}
+}
+
+static void statinit(struct stats *s)
+{
+	memset(s,0,sizeof(struct stats));
+	s->min=-1;
+}
+
+static int statadd(struct stats *s,uint64_t val)
+{
+	int e;
 	int chg=0;
+
+	s->sum+=val;
+	s->n++;
+	if(val<s->min)
+	{
+		s->min=val;
+		chg=1;
+	}
+	if(val>s->max)
+	{
+		s->max=val;
+		chg=1;
+	}
+
+	if(val<(HISTSUB<<1))s->hist[val]++;
+	else if((e=63-__builtin_clzll(val))>=HISTMAX)s->hist[HISTSIZE-1]++;
+	else s->hist[(e-HISTBITS)*HISTSUB+(val>>(e-HISTBITS))]++;
+
+	return chg;
+}
+
+static uint64_t histtop(int idx)
+{
+	int shift;
+
+	if(idx<(HISTSUB<<1))return idx;
+	shift=idx/HISTSUB-1;
+	return ((uint64_t)(idx-shift*HISTSUB+1)<<shift)-1;
+}
+
+static uint64_t statpct(struct stats *s,double pct)
+{
+	int i;
+	uint64_t cnt;
 	uint64_t val;
-	uint64_t min=-1;
-	uint64_t max=0;
-	uint64_t sum=0;
-	uint64_t n=0;
-	uint64_t mask=dly?0xf:0x7ff;
-	struct pollfd p;
+	double lim;
+
+	if(!s->n)return 0;
+	lim=pct*s->n/100.0;
+	if((cnt=lim)<lim)cnt++;
+	if(!cnt)cnt=1;
+	for(i=0;i<HISTSIZE-1;cnt-=s->hist[i++])if(s->hist[i]>=cnt)break;
+	val=histtop(i);
+	if(val>s->max)val=s->max;
+	if(val<s->min)val=s->min;
+	return val;
+}
+
+static int tsdiff(struct timespec *tm,struct timespec *data,uint64_t *val)
+{
+	struct timespec d=*tm;
+
+	if(d.tv_nsec<data->tv_nsec)
+	{
+		d.tv_nsec+=1000000000;
+		d.tv_sec--;
+	}
+	if(d.tv_sec<data->tv_sec)return -1;
+	if(d.tv_sec!=data->tv_sec)return 1;
+	*val=d.tv_nsec-data->tv_nsec;
+	return 0;
+}
+
+static char *mkdatim(char *datim,int ts)
+{
 	struct timespec tm;
-	uint16_t vdata[2];
 	struct tm stm;
-	char datim[64];
 
-	p.fd=rx->fd;
-	p.events=POLLIN;
+	if(ts)
+	{
+		clock_gettime(CLOCK_REALTIME,&tm);
+		localtime_r(&tm.tv_sec,&stm);
+		strftime(datim,64,"%T",&stm);
+		sprintf(datim+8,".%09lu ",tm.tv_nsec);
+	}
+	else *datim=0;
+	return datim;
+}
 
-	vdata[0]=htobe16((prio<<13)|(vid&0xfff));
-	vdata[1]=htobe16(ETH_P_802_EX1);
+static void capopt(unsigned char **p,int code,void *data,int len)
+{
+	uint16_t hdr[2];
 
-	while(1)
-	{
-		curr=tx->head;
-		next=tx->head+1;
-		if(next==tx->total)next=0;
+	hdr[0]=code;
+	hdr[1]=len;
+	memcpy(*p,hdr,4);
+	if(len)memcpy(*p+4,data,len);
+	memset(*p+4+len,0,(4-(len&3))&3);
+	*p+=4+((len+3)&~3);
+}
 
-		while(tx->tail!=curr)
-		{
-			txhdr=(struct tpacket2_hdr *)tx->data[tx->tail];
-			switch(txhdr->tp_status)
-			{
-			case TP_STATUS_WRONG_FORMAT:
-				txhdr->tp_status=TP_STATUS_AVAILABLE;
-			case TP_STATUS_AVAILABLE:
-				if((tx->tail+=1)==tx->total)tx->tail=0;
-				continue;
-			}
-			break;
-		}
+static struct pcap *capopen(char *file,char *dev,int udp,
+	struct sockaddr_storage *ss,int tos,uint64_t thresh)
+{
+	int s;
+	int64_t mono;
+	uint32_t len;
+	uint32_t shb[7]={0x0a0d0d0a,28,0x1a2b3c4d,0,0xffffffff,0xffffffff,28};
+	uint16_t ver[2]={1,0};
+	uint16_t lt[2]={udp?LINKTYPE_RAW:LINKTYPE_ETHERNET,0};
+	socklen_t sl;
+	struct pcap *c;
+	struct sockaddr_storage la;
+	struct timespec tm;
+	unsigned char *p;
+	unsigned char tsresol=9;
+	unsigned char blk[512];
+	char desc[128];
 
-		txhdr=(struct tpacket2_hdr *)tx->data[curr];
-		switch(txhdr->tp_status)
-		{
-		case TP_STATUS_WRONG_FORMAT:
-			txhdr->tp_status=TP_STATUS_AVAILABLE;
-		case TP_STATUS_AVAILABLE:
-			break;
-		default:fprintf(stderr,"transmit queue overflow\n");
-			return;
-		}
+	if(!(c=malloc(sizeof(struct pcap))))goto err1;
+	memset(c,0,sizeof(struct pcap));
+	c->udp=udp;
+	c->tos=tos;
+	c->thresh=thresh;
 
-		txe=(struct ethhdr *)(tx->data[curr]+tx->hoff);
-		memcpy(txe->h_source,src,ETH_ALEN);
-		memcpy(txe->h_dest,dst,ETH_ALEN);
+	/* pcapng wants wall clock time, probes use the monotonic clock */
+	clock_gettime(CLOCK_MONOTONIC,&tm);
+	mono=tm.tv_sec*1000000000LL+tm.tv_nsec;
+	clock_gettime(CLOCK_REALTIME,&tm);
+	c->off=tm.tv_sec*1000000000LL+tm.tv_nsec-mono;
 
-		if(prio)
+	if(udp)
+	{
+		c->family=ss->ss_family;
+		if((s=socket(c->family,SOCK_DGRAM|SOCK_CLOEXEC,0))==-1)
+			goto err2;
+		if(dev)if(setsockopt(s,SOL_SOCKET,SO_BINDTODEVICE,dev,
+			strlen(dev)))goto err3;
+		sl=sizeof(la);
+		if(connect(s,(struct sockaddr *)ss,sizeof(*ss))||
+			getsockname(s,(struct sockaddr *)&la,&sl))goto err3;
+		close(s);
+		if(c->family==AF_INET)
 		{
-			txe->h_proto=htobe16(ETH_P_8021Q);
-			memcpy(tx->data[curr]+tx->doff,vdata,4);
-			clock_gettime(CLOCK_MONOTONIC,
-				(void *)(tx->data[curr]+tx->doff+4));
+			memcpy(c->lip,&((struct sockaddr_in *)&la)->
+				sin_addr.s_addr,4);
+			memcpy(c->rip,&((struct sockaddr_in *)ss)->
+				sin_addr.s_addr,4);
 		}
 		else
 		{
-			txe->h_proto=htobe16(ETH_P_802_EX1);
-			clock_gettime(CLOCK_MONOTONIC,
-				(void *)(tx->data[curr]+tx->doff));
-		}
-
-		txhdr->tp_len=DATASIZE;
-		txhdr->tp_status=TP_STATUS_SEND_REQUEST;
-		tx->head=next;
-		rep=50;
-again:		if(send(tx->fd,NULL,0,MSG_DONTWAIT)<0)
-		{
-			if(errno==ENOBUFS)
-			{
-				if(rep--)
-				{
-					if(!fast)usleep(2);
-					goto again;
-				}
-				perror("Warning: send");
-				goto skip;
-			}
-			perror("send\n");
-			return;
-		}
-
-		if(poll(&p,1,1000)<1)
-		{
-			fprintf(stderr,"Warning: poll timed out\n");
-			goto skip;
+			memcpy(c->lip,((struct sockaddr_in6 *)&la)->
+				sin6_addr.s6_addr,16);
+			memcpy(c->rip,((struct sockaddr_in6 *)ss)->
+				sin6_addr.s6_addr,16);
 		}
+	}
 
-		clock_gettime(CLOCK_MONOTONIC,&tm);
+	if(!(c->fp=fopen(file,"we")))goto err2;
 
-		if(!(p.revents&POLLIN))
-		{
-			fprintf(stderr,"Warning: no data after poll\n");
-			goto skip;
-		}
+	/* all fields in host byte order as told by the byte order magic */
+	memcpy(blk,shb,28);
+	memcpy(blk+12,ver,4);
+	p=blk+28;
+	len=1;
+	memcpy(p,&len,4);
+	memcpy(p+8,lt,4);
+	len=0;
+	memcpy(p+12,&len,4);
+	p+=16;
+	if(dev)capopt(&p,2,dev,strlen(dev));
+	if(thresh)snprintf(desc,sizeof(desc),"netdelay %s initiator, probes "
+		"with a roundtrip of at least %llu ns",udp?"UDP":"layer 2",
+		(unsigned long long)thresh);
+	else snprintf(desc,sizeof(desc),"netdelay %s initiator, probes "
+		"reaching the maximum roundtrip",udp?"UDP":"layer 2");
+	capopt(&p,3,desc,strlen(desc));
+	capopt(&p,9,&tsresol,1);
+	capopt(&p,0,NULL,0);
+	len=p-blk+4-28;
+	memcpy(blk+28+4,&len,4);
+	memcpy(p,&len,4);
+	p+=4;
 
-		rxhdr=(struct tpacket2_hdr *)rx->data[rx->index];
-		if(!(rxhdr->tp_status&TP_STATUS_USER))return;
-		data=(struct timespec *)(rx->data[rx->index]+rx->doff);
+	if(fwrite(blk,p-blk,1,c->fp)!=1||fflush(c->fp))goto err4;
 
-		if(tm.tv_nsec<data->tv_nsec)
-		{
-			tm.tv_nsec+=1000000000;
-			tm.tv_sec--;
-		}
-		if(tm.tv_sec<data->tv_sec)
-		{
-			fprintf(stderr,"time mismatch, aborting\n");
-			return;
-		}
-		tm.tv_sec-=data->tv_sec;
-		tm.tv_nsec-=data->tv_nsec;
+	return c;
 
-		rxhdr->tp_status=TP_STATUS_KERNEL;
-		if((rx->index+=1)==rx->total)rx->index=0;
+err4:	fclose(c->fp);
+	unlink(file);
+	goto err2;
+err3:	close(s);
+err2:	free(c);
+err1:	return NULL;
+}
 
-		if(tm.tv_sec)fprintf(stderr, "Warning: wrong data skipped\n");
-		else if(pre)pre--;
-		else
-		{
-			val=tm.tv_sec;
-			val*=1000000000;
-			val+=tm.tv_nsec;
-			sum+=val;
-			n++;
-			if(val<min)
-			{
-				min=val;
-				chg=1;
-			}
-			if(val>max)
-			{
-				max=val;
-				chg=1;
-			}
+static void capadd(struct pcap *c,int out,struct timespec *ts,void *frame,
+	int len,uint64_t val)
+{
+	uint32_t *hdr;
+	uint32_t flags=out?2:1;
+	uint64_t tm;
+	unsigned char *p;
+	char cmt[64];
 
-			if(!(n&mask))
-			{
-				if(ts)
-				{
-					clock_gettime(CLOCK_REALTIME,&tm);
-					localtime_r(&tm.tv_sec,&stm);
-					strftime(datim,sizeof(datim),"%T",&stm);
-					sprintf(datim+8,".%09lu ",tm.tv_nsec);
-				}
-				else *datim=0;
-				printf(" %s%llu %llu %llu%s",datim,
-					(unsigned long long)min,
-					(unsigned long long)(sum/n),
-					(unsigned long long)max,
-					chg||cont?"\n":"        \r");
-				if(!chg&&!cont)fflush(stdout);
-				chg=0;
-			}
-		}
+	if(c->len+len+128>CAPBUF)
+	{
+		c->drop++;
+		return;
+	}
 
-skip:		if(dly)usleep(dly);
+	hdr=(uint32_t *)(c->bfr+c->len);
+	tm=ts->tv_sec*1000000000ULL+ts->tv_nsec+c->off;
+	hdr[0]=6;
+	hdr[2]=0;
+	hdr[3]=tm>>32;
+	hdr[4]=(uint32_t)tm;
+	hdr[5]=len;
+	hdr[6]=len;
+	p=(unsigned char *)(hdr+7);
+	memcpy(p,frame,len);
+	memset(p+len,0,(4-(len&3))&3);
+	p+=(len+3)&~3;
+	if(val)
+	{
+		sprintf(cmt,"roundtrip %llu ns",(unsigned long long)val);
+		capopt(&p,1,cmt,strlen(cmt));
 	}
+	capopt(&p,2,&flags,4);
+	capopt(&p,0,NULL,0);
+	hdr[1]=p-(unsigned char *)hdr+4;
+	memcpy(p,&hdr[1],4);
+	c->len+=hdr[1];
 }
 
-static void l2responder(struct rxtx *rx,struct rxtx *tx,int prio,int vid,
-	int fast)
+static void capl2(struct pcap *c,struct rxtx *tx,int slot,
+	struct tpacket2_hdr *rxhdr,struct timespec *sent,struct timespec *rcvd,
+	uint64_t val)
 {
-	struct pollfd p;
-	void *data;
-	struct tpacket2_hdr *rxhdr;
-	struct tpacket2_hdr *txhdr;
-	struct ethhdr *rxe;
-	struct ethhdr *txe;
-	int curr;
-	int next;
-	int rep;
-	uint16_t vdata[2];
+	int len=rxhdr->tp_snaplen;
+	unsigned char *frame=(unsigned char *)rxhdr+rxhdr->tp_mac;
+	uint16_t tag[2];
+	unsigned char bfr[DATASIZE+4];
 
-	p.fd=rx->fd;
-	p.events=POLLIN;
+	capadd(c,1,sent,tx->data[slot]+tx->hoff,DATASIZE,0);
 
-	vdata[0]=htobe16((prio<<13)|(vid&0xfff));
+	if(len>DATASIZE)len=DATASIZE;
 
-	while(1)
+	/* put back received vlan tags the kernel reports as stripped */
+	if(rxhdr->tp_status&TP_STATUS_VLAN_VALID)
 	{
-		if(poll(&p,1,-1)<1)continue;
-		if(!(p.revents&POLLIN))continue;
+		tag[0]=htobe16(rxhdr->tp_status&TP_STATUS_VLAN_TPID_VALID?
+			rxhdr->tp_vlan_tpid:ETH_P_8021Q);
+		tag[1]=htobe16(rxhdr->tp_vlan_tci);
+		memcpy(bfr,frame,12);
+		memcpy(bfr+12,tag,4);
+		memcpy(bfr+16,frame+12,len-12);
+		frame=bfr;
+		len+=4;
+	}
+	capadd(c,0,rcvd,frame,len,val);
+}
 
-		while(1)
-		{
-			rxhdr=(struct tpacket2_hdr *)rx->data[rx->index];
-			if(!(rxhdr->tp_status&TP_STATUS_USER))break;
-			data=(struct l2msg *)(rx->data[rx->index]+rx->doff);
+/* ones complement sum of an even length in network byte order */
+static uint32_t capsum(uint32_t sum,void *data,int len)
+{
+	int i;
+	uint16_t w;
 
-			curr=tx->head;
-			next=tx->head+1;
-			if(next==tx->total)next=0;
+	for(i=0;i<len;i+=2)
+	{
+		memcpy(&w,(unsigned char *)data+i,2);
+		sum+=w;
+	}
+	return sum;
+}
 
-			while(tx->tail!=curr)
-			{
-				txhdr=(struct tpacket2_hdr *)tx->data[tx->tail];
-				switch(txhdr->tp_status)
-				{
-				case TP_STATUS_WRONG_FORMAT:
-					txhdr->tp_status=TP_STATUS_AVAILABLE;
-				case TP_STATUS_AVAILABLE:
-					if((tx->tail+=1)==tx->total)tx->tail=0;
-					continue;
+static uint16_t capfold(uint32_t sum)
+{
+	while(sum>>16)sum=(sum&0xffff)+(sum>>16);
+	return ~sum;
+}
+
+static void capudp(struct pcap *c,int lport,int rport,int tos,void *data,
+	struct timespec *sent,struct timespec *rcvd,uint64_t val)
+{
+	int i;
+	int hl=c->family==AF_INET?20:40;
+	int al=c->family==AF_INET?4:16;
+	int proto=c->udp==2?IPPROTO_UDPLITE:IPPROTO_UDP;
+	uint16_t sum;
+	uint16_t ph[2]={htobe16(proto),htobe16(8+DATASIZE)};
+	unsigned char bfr[40+8+DATASIZE];
+
+	memset(bfr,0,hl+8);
+	if(c->family==AF_INET)
+	{
+		bfr[0]=0x45;
+		bfr[1]=tos;
+		bfr[2]=(hl+8+DATASIZE)>>8;
+		bfr[3]=(hl+8+DATASIZE)&0xff;
+		bfr[6]=0x40;
+		bfr[8]=64;
+		bfr[9]=proto;
+	}
+	else
+	{
+		bfr[0]=0x60|(tos>>4);
+		bfr[1]=tos<<4;
+		bfr[4]=(8+DATASIZE)>>8;
+		bfr[5]=(8+DATASIZE)&0xff;
+		bfr[6]=proto;
+		bfr[7]=64;
+	}
+	bfr[hl+4]=(8+DATASIZE)>>8;
+	bfr[hl+5]=(8+DATASIZE)&0xff;
+	memcpy(bfr+hl+8,data,DATASIZE);
+
+	for(i=0;i<2;i++)
+	{
+		if(c->family==AF_INET)
+		{
+			memcpy(bfr+12,i?c->rip:c->lip,4);
+			memcpy(bfr+16,i?c->lip:c->rip,4);
+			bfr[10]=bfr[11]=0;
+			sum=capfold(capsum(0,bfr,20));
+			memcpy(bfr+10,&sum,2);
+		}
+		else
+		{
+			memcpy(bfr+8,i?c->rip:c->lip,16);
+			memcpy(bfr+24,i?c->lip:c->rip,16);
+		}
+		bfr[hl]=(i?rport:lport)>>8;
+		bfr[hl+1]=(i?rport:lport)&0xff;
+		bfr[hl+2]=(i?lport:rport)>>8;
+		bfr[hl+3]=(i?lport:rport)&0xff;
+
+		/* the addresses end right before the transport header */
+		bfr[hl+6]=bfr[hl+7]=0;
+		sum=capfold(capsum(capsum(0,ph,4),bfr+hl-2*al,2*al+8+DATASIZE));
+		if(!sum)sum=0xffff;
+		memcpy(bfr+hl+6,&sum,2);
+		capadd(c,!i,i?rcvd:sent,bfr,hl+8+DATASIZE,i?val:0);
+	}
+}
+
+static void capflush(struct pcap *c)
+{
+	if(c->len)
+	{
+		if(fwrite(c->bfr,c->len,1,c->fp)!=1||fflush(c->fp))
+			perror("Warning: capture write");
+		c->len=0;
+	}
+	if(c->drop)
+	{
+		fprintf(stderr,"Warning: %llu frames dropped from capture\n",
+			(unsigned long long)c->drop);
+		c->drop=0;
+	}
+}
+
+static int capwant(struct stats *s,uint64_t val)
+{
+	if(!cap)return 0;
+	if(cap->thresh)return val>=cap->thresh;
+	return val>=s->max;
+}
+
+static char *mkload(char *bfr)
+{
+	uint64_t pkts;
+	uint64_t bytes;
+	double dt;
+	struct timespec tm;
+
+	if(!lgen)
+	{
+		*bfr=0;
+		return bfr;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&tm);
+	pkts=__atomic_load_n(&lgen->pkts,__ATOMIC_RELAXED);
+	bytes=__atomic_load_n(&lgen->bytes,__ATOMIC_RELAXED);
+	dt=(tm.tv_sec-lgen->last.tv_sec)*1000000000.0+
+		(tm.tv_nsec-lgen->last.tv_nsec);
+	sprintf(bfr," load %.0f pps %.1f Mbit/s",
+		(pkts-lgen->lpkts)*1000000000.0/dt,
+		(bytes-lgen->lbytes)*8000.0/dt);
+	lgen->lpkts=pkts;
+	lgen->lbytes=bytes;
+	lgen->last=tm;
+	return bfr;
+}
+
+static void statprint(struct stats *s,int ts,int cont,int chg)
+{
+	char datim[64];
+	char ldr[64];
+
+	printf(" %s%llu %llu %llu%s%s",mkdatim(datim,ts),
+		(unsigned long long)s->min,
+		(unsigned long long)(s->sum/s->n),
+		(unsigned long long)s->max,mkload(ldr),
+		chg||cont?"\n":"        \r");
+	if(!chg&&!cont)fflush(stdout);
+	if(cap)capflush(cap);
+}
+
+static void clsprint(struct stats *s,int n,int ts,int cont,int chg)
+{
+	int i;
+	char datim[64];
+	char ldr[64];
+
+	printf(" %s",mkdatim(datim,ts));
+	for(i=0;i<n;i++)
+	{
+		if(!s[i].n)printf("%s%s:-",i?"  ":"",label[i]);
+		else printf("%s%s:%llu/%llu/%llu/%llu",i?"  ":"",label[i],
+			(unsigned long long)s[i].min,
+			(unsigned long long)(s[i].sum/s[i].n),
+			(unsigned long long)statpct(&s[i],99.0),
+			(unsigned long long)s[i].max);
+	}
+	printf("%s%s",mkload(ldr),chg||cont?"\n":"        \r");
+	if(!chg&&!cont)fflush(stdout);
+	if(cap)capflush(cap);
+}
+
+/* single producer single consumer ring towards the reporter thread,
+   the producer only waits if the ring is really full */
+static void reppush(struct report *r,int type,struct stats *s,uint64_t val)
+{
+	struct repent *e;
+
+	if(r->head-r->ctail==REPRING)
+		while(r->head-(r->ctail=__atomic_load_n(&r->tail,
+			__ATOMIC_ACQUIRE))==REPRING);
+	e=&r->ring[r->head&(REPRING-1)];
+	e->s=s;
+	e->val=val;
+	e->type=type;
+	__atomic_store_n(&r->head,r->head+1,__ATOMIC_RELEASE);
+}
+
+static int statsample(struct stats *s,uint64_t val)
+{
+	if(!rep)return statadd(s,val);
+	reppush(rep,REP_SAMPLE,s,val);
+	return 0;
+}
+
+static void statlost(struct stats *s)
+{
+	if(!rep)s->lost++;
+	else reppush(rep,REP_LOST,s,0);
+}
+
+/* n is the number of labelled statistics, 0 for a single one */
+static void statreport(struct stats *s,int n,int ts,int cont,int chg)
+{
+	if(rep)reppush(rep,REP_PRINT,s,n);
+	else if(n)clsprint(s,n,ts,cont,chg);
+	else statprint(s,ts,cont,chg);
+}
+
+/* the measurement core shared by all initiators: pre probes or rounds
+   warm up the path, every accounted sample or round counts towards the
+   limit and every mask+1 of them are reported for the nst labelled
+   statistics of st */
+static inline int measpre(struct meas *m)
+{
+	if(!m->pre)return 0;
+	m->pre--;
+	return 1;
+}
+
+static inline void measround(struct meas *m,struct stats *st)
+{
+	if(++m->n==limit)stop=1;
+	if(!(m->n&m->mask))
+	{
+		statreport(st,m->nst,m->ts,m->cont,m->chg);
+		m->chg=0;
+	}
+}
+
+/* single flow initiators, returns 1 if the sample was taken */
+static inline int measure(struct meas *m,struct stats *st,uint64_t val)
+{
+	if(measpre(m))return 0;
+	m->chg|=statsample(st,val);
+	measround(m,st);
+	return 1;
+}
+
+/* rounds of several probes, the caller accounts the round while m->pre
+   is 0, the warm-up only counts complete rounds */
+static inline void measend(struct meas *m,struct stats *st,int complete)
+{
+	if(!m->pre)measround(m,st);
+	else if(complete)m->pre--;
+}
+
+static void *reporter(void *arg)
+{
+	int chg=0;
+	int done;
+	uint64_t head;
+	uint64_t tail=0;
+	struct report *r=arg;
+	struct repent *e;
+	struct timespec w={0,100000};
+
+	while(1)
+	{
+		done=__atomic_load_n(&r->done,__ATOMIC_ACQUIRE);
+		head=__atomic_load_n(&r->head,__ATOMIC_ACQUIRE);
+		if(tail==head)
+		{
+			if(done)break;
+			nanosleep(&w,NULL);
+			continue;
+		}
+
+		for(;tail!=head;tail++)
+		{
+			e=&r->ring[tail&(REPRING-1)];
+			switch(e->type)
+			{
+			case REP_SAMPLE:
+				chg|=statadd(e->s,e->val);
+				break;
+
+			case REP_LOST:
+				e->s->lost++;
+				break;
+
+			case REP_AUX:
+				statadd(e->s,e->val);
+				break;
+
+			case REP_PRINT:
+				if(e->val)clsprint(e->s,e->val,r->ts,r->cont,
+					chg);
+				else statprint(e->s,r->ts,r->cont,chg);
+				chg=0;
+				break;
+			}
+		}
+		__atomic_store_n(&r->tail,tail,__ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static uint64_t tsns(struct timespec *ts)
+{
+	return ts->tv_sec*1000000000ULL+ts->tv_nsec;
+}
+
+static void txstage(struct txstamp *t,int stage,uint64_t from,uint64_t to)
+{
+	if(!from||to<from)return;
+	if(rep)reppush(rep,REP_AUX,&t->st[stage],to-from);
+	else statadd(&t->st[stage],to-from);
+}
+
+/* the software stamps of the error queue and the ring are CLOCK_REALTIME,
+   hardware stamps are only comparable if the NIC clock is synchronized
+   to it */
+static int txdrain(int s,struct txstamp *t)
+{
+	int n=0;
+	struct msghdr mh;
+	struct cmsghdr *cm;
+	struct scm_timestamping *tss;
+	struct sock_extended_err *ee;
+	struct txprobe *p;
+	union
+	{
+		struct cmsghdr align;
+		unsigned char bfr[512];
+	} cmsg;
+
+	while(1)
+	{
+		memset(&mh,0,sizeof(mh));
+		mh.msg_control=cmsg.bfr;
+		mh.msg_controllen=sizeof(cmsg.bfr);
+		if(recvmsg(s,&mh,MSG_ERRQUEUE|MSG_DONTWAIT)<0)break;
+		n++;
+
+		tss=NULL;
+		ee=NULL;
+		for(cm=CMSG_FIRSTHDR(&mh);cm;cm=CMSG_NXTHDR(&mh,cm))
+		{
+			if(cm->cmsg_level==SOL_SOCKET&&
+				cm->cmsg_type==SCM_TIMESTAMPING)
+				tss=(struct scm_timestamping *)CMSG_DATA(cm);
+			else if((cm->cmsg_level==SOL_IP&&
+				cm->cmsg_type==IP_RECVERR)||
+				(cm->cmsg_level==SOL_IPV6&&
+				cm->cmsg_type==IPV6_RECVERR))
+				ee=(struct sock_extended_err *)CMSG_DATA(cm);
+		}
+		if(!tss||!ee||ee->ee_origin!=SO_EE_ORIGIN_TIMESTAMPING)
+			continue;
+
+		p=&t->p[ee->ee_data&(TXPROBES-1)];
+		if(p->id!=ee->ee_data||!p->sent)continue;
+
+		if(ee->ee_info==SCM_TSTAMP_SCHED&&!p->sched)
+		{
+			p->sched=tsns(&tss->ts[0]);
+			txstage(t,0,p->sent,p->sched);
+		}
+		else if(ee->ee_info==SCM_TSTAMP_SND)
+		{
+			if(tss->ts[0].tv_sec&&!p->snd)
+			{
+				p->snd=tsns(&tss->ts[0]);
+				txstage(t,1,p->sched?p->sched:p->sent,p->snd);
+			}
+			if(tss->ts[2].tv_sec&&!p->hw)p->hw=tsns(&tss->ts[2]);
+		}
+
+		if(p->snd&&p->hw)
+		{
+			txstage(t,2,p->snd,p->hw);
+			p->sent=0;
+		}
+	}
+	return n;
+}
+
+/* now is NULL for warm-up probes, their stamps are not accounted */
+static void txsent(struct txstamp *t,struct timespec *now)
+{
+	struct txprobe *p=&t->p[t->id&(TXPROBES-1)];
+
+	memset(p,0,sizeof(struct txprobe));
+	p->id=t->id++;
+	p->sent=now?tsns(now):0;
+}
+
+/* with PACKET_TIMESTAMP the kernel stores the completion stamp in the
+   frame when it hands it back, sent is NULL for warm-up probes */
+static void txring(struct txstamp *t,struct tpacket2_hdr *txhdr,
+	struct timespec *sent)
+{
+	uint32_t status=txhdr->tp_status;
+	struct timespec ts;
+
+	if((status&~TP_STATUS_TS)!=TP_STATUS_AVAILABLE||status==
+		TP_STATUS_AVAILABLE)return;
+	ts.tv_sec=txhdr->tp_sec;
+	ts.tv_nsec=txhdr->tp_nsec;
+	if(sent)txstage(t,status&TP_STATUS_TS_RAW_HARDWARE?2:1,tsns(sent),
+		tsns(&ts));
+	txhdr->tp_status=TP_STATUS_AVAILABLE;
+}
+
+static struct tpacket2_hdr *txget(struct rxtx *tx)
+{
+	struct tpacket2_hdr *txhdr;
+
+	while(tx->tail!=tx->head)
+	{
+		txhdr=(struct tpacket2_hdr *)tx->data[tx->tail];
+		switch(txhdr->tp_status&~TP_STATUS_TS)
+		{
+		case TP_STATUS_WRONG_FORMAT:
+			txhdr->tp_status=TP_STATUS_AVAILABLE;
+		case TP_STATUS_AVAILABLE:
+			if((tx->tail+=1)==tx->total)tx->tail=0;
+			continue;
+		}
+		break;
+	}
+
+	txhdr=(struct tpacket2_hdr *)tx->data[tx->head];
+	switch(txhdr->tp_status&~TP_STATUS_TS)
+	{
+	case TP_STATUS_WRONG_FORMAT:
+		txhdr->tp_status=TP_STATUS_AVAILABLE;
+	case TP_STATUS_AVAILABLE:
+		return txhdr;
+	default:return NULL;
+	}
+}
+
+static int txsend(struct rxtx *tx,int fast)
+{
+	int rep=50;
+
+	while(send(tx->fd,NULL,0,MSG_DONTWAIT)<0)
+	{
+		if(errno!=ENOBUFS)return -1;
+		if(rst)rst->nobufs++;
+		if(!rep--)return 1;
+		if(!fast)usleep(2);
+	}
+	return 0;
+}
+
+/* the probe loops are specialized at compile time for the options that
+   are tested per probe, vlan, fast, wait and inst are constants */
+static inline __attribute__((always_inline)) int l2loop(struct rxtx *tx,
+	struct rxtx *rx,void *src,void *dst,int prio,int vid,int ts,int dly,
+	int cont,struct stats *st,const int vlan,const int fast,const int wait,
+	const int inst)
+{
+	struct tpacket2_hdr *rxhdr;
+	struct tpacket2_hdr *txhdr;
+	struct ethhdr *txe;
+	struct timespec *data;
+	int slot;
+	uint64_t val;
+	struct meas m={20,0,ts,cont,0,wait?0xf:0x7ff};
+	struct pollfd p;
+	struct timespec tm;
+	struct timespec rt;
+	struct timespec *sent=NULL;
+	uint16_t vdata[2];
+
+	p.fd=rx->fd;
+	p.events=POLLIN;
+
+	vdata[0]=htobe16((prio<<13)|(vid&0xfff));
+	vdata[1]=htobe16(ETH_P_802_EX1);
+
+	while(!stop)
+	{
+		if(!(txhdr=txget(tx)))
+		{
+			fprintf(stderr,"transmit queue overflow\n");
+			return -1;
+		}
+
+		txe=(struct ethhdr *)(tx->data[tx->head]+tx->hoff);
+		memcpy(txe->h_source,src,ETH_ALEN);
+		memcpy(txe->h_dest,dst,ETH_ALEN);
+
+		if(vlan)
+		{
+			txe->h_proto=htobe16(ETH_P_8021Q);
+			memcpy(tx->data[tx->head]+tx->doff,vdata,4);
+			clock_gettime(CLOCK_MONOTONIC,
+				(void *)(tx->data[tx->head]+tx->doff+4));
+		}
+		else
+		{
+			txe->h_proto=htobe16(ETH_P_802_EX1);
+			clock_gettime(CLOCK_MONOTONIC,
+				(void *)(tx->data[tx->head]+tx->doff));
+		}
+
+		txhdr->tp_len=DATASIZE;
+		txhdr->tp_status=TP_STATUS_SEND_REQUEST;
+		slot=tx->head;
+		if((tx->head+=1)==tx->total)tx->head=0;
+
+		if(inst&&tstx)
+		{
+			clock_gettime(CLOCK_REALTIME,&rt);
+			sent=m.pre?NULL:&rt;
+		}
+		switch(txsend(tx,fast))
+		{
+		case -1:perror("send\n");
+			return -1;
+		case 1:	perror("Warning: send");
+			goto skip;
+		}
+
+		if(poll(&p,1,1000)<1)
+		{
+			if(stop)break;
+			fprintf(stderr,"Warning: poll timed out\n");
+			if(!m.pre)statlost(st);
+			goto skip;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC,&tm);
+
+		if(!(p.revents&POLLIN))
+		{
+			fprintf(stderr,"Warning: no data after poll\n");
+			goto skip;
+		}
+
+		rxhdr=(struct tpacket2_hdr *)rx->data[rx->index];
+		if(!(rxhdr->tp_status&TP_STATUS_USER))return -1;
+		data=(struct timespec *)(rx->data[rx->index]+rx->doff);
+
+		switch(tsdiff(&tm,data,&val))
+		{
+		case -1:fprintf(stderr,"time mismatch, aborting\n");
+			return -1;
+		case 1:	fprintf(stderr, "Warning: wrong data skipped\n");
+			break;
+		default:if(measure(&m,st,val)&&inst&&capwant(st,val))
+				capl2(cap,tx,slot,rxhdr,data,&tm,val);
+		}
+
+		rxhdr->tp_status=TP_STATUS_KERNEL;
+		if((rx->index+=1)==rx->total)rx->index=0;
+
+skip:		if(inst&&tstx)txring(tstx,(struct tpacket2_hdr *)tx->data[slot],
+			sent);
+		if(wait)usleep(dly);
+	}
+	return 0;
+}
+
+#define L2INIT(v,f,w,i)							\
+static int l2init##v##f##w##i(struct rxtx *tx,struct rxtx *rx,void *src,	\
+	void *dst,int prio,int vid,int ts,int dly,int cont,struct stats *st)\
+{									\
+	return l2loop(tx,rx,src,dst,prio,vid,ts,dly,cont,st,v,f,w,i);	\
+}
+
+L2INIT(0,0,0,0) L2INIT(0,0,0,1) L2INIT(0,0,1,0) L2INIT(0,0,1,1)
+L2INIT(0,1,0,0) L2INIT(0,1,0,1) L2INIT(0,1,1,0) L2INIT(0,1,1,1)
+L2INIT(1,0,0,0) L2INIT(1,0,0,1) L2INIT(1,0,1,0) L2INIT(1,0,1,1)
+L2INIT(1,1,0,0) L2INIT(1,1,0,1) L2INIT(1,1,1,0) L2INIT(1,1,1,1)
+
+static int (*const l2init[16])(struct rxtx *tx,struct rxtx *rx,void *src,
+	void *dst,int prio,int vid,int ts,int dly,int cont,struct stats *st)=
+{
+	l2init0000,l2init0001,l2init0010,l2init0011,
+	l2init0100,l2init0101,l2init0110,l2init0111,
+	l2init1000,l2init1001,l2init1010,l2init1011,
+	l2init1100,l2init1101,l2init1110,l2init1111
+};
+
+/* capture and transmit stamps share the instrumented variants */
+static int l2initiator(struct rxtx *tx,struct rxtx *rx,void *src,void *dst,
+	int prio,int vid,int ts,int dly,int cont,int fast,struct stats *st)
+{
+	return l2init[(prio?8:0)|(fast?4:0)|(dly?2:0)|(cap||tstx?1:0)](tx,rx,
+		src,dst,prio,vid,ts,dly,cont,st);
+}
+
+static int l2clsinitiator(struct rxtx *tx,struct rxtx *rx,void *src,
+	void *dst,int *cls,int ncls,int vid,int ts,int dly,int cont,int fast,
+	struct stats *st)
+{
+	struct tpacket2_hdr *rxhdr;
+	struct tpacket2_hdr *txhdr;
+	struct ethhdr *txe;
+	struct probe *data;
+	int i;
+	int k;
+	int got;
+	int all=(1<<ncls)-1;
+	int tmo;
+	int slot[MAXCLASS];
+	uint32_t seq=0;
+	uint64_t val;
+	struct meas m={20,0,ts,cont,0,dly?0xf:0x7ff,ncls};
+	struct pollfd p;
+	struct timespec tm;
+	struct timespec end;
+	uint16_t vdata[MAXCLASS][2];
+
+	p.fd=rx->fd;
+	p.events=POLLIN;
+
+	for(i=0;i<ncls;i++)
+	{
+		vdata[i][0]=htobe16((cls[i]<<13)|(vid&0xfff));
+		vdata[i][1]=htobe16(ETH_P_802_EX1);
+	}
+
+	while(!stop)
+	{
+		/* rotate the burst order so that no class is always sent
+		   first or processed last */
+		for(i=0;i<ncls;i++)
+		{
+			if(!(txhdr=txget(tx)))
+			{
+				fprintf(stderr,"transmit queue overflow\n");
+				return -1;
+			}
+
+			k=(seq+i)%ncls;
+			txe=(struct ethhdr *)(tx->data[tx->head]+tx->hoff);
+			memcpy(txe->h_source,src,ETH_ALEN);
+			memcpy(txe->h_dest,dst,ETH_ALEN);
+			txe->h_proto=htobe16(ETH_P_8021Q);
+			memcpy(tx->data[tx->head]+tx->doff,vdata[k],4);
+			data=(struct probe *)(tx->data[tx->head]+tx->doff+4);
+			data->seq=seq;
+			data->cls=k;
+			data->flags=PROBE_PRIO;
+			data->prio=cls[k];
+			clock_gettime(CLOCK_MONOTONIC,&data->ts);
+
+			txhdr->tp_len=DATASIZE;
+			txhdr->tp_status=TP_STATUS_SEND_REQUEST;
+			slot[k]=tx->head;
+			if((tx->head+=1)==tx->total)tx->head=0;
+		}
+
+		switch(txsend(tx,fast))
+		{
+		case -1:perror("send\n");
+			return -1;
+		case 1:	perror("Warning: send");
+			if(!m.pre)for(i=0;i<ncls;i++)statlost(&st[i]);
+			goto skip;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC,&end);
+		end.tv_sec++;
+
+		for(got=0;got!=all;)
+		{
+			clock_gettime(CLOCK_MONOTONIC,&tm);
+			if(tsdiff(&end,&tm,&val))tmo=0;
+			else tmo=val/1000000;
+
+			if(poll(&p,1,tmo)<1)
+			{
+				if(!stop)fprintf(stderr,
+					"Warning: poll timed out\n");
+				break;
+			}
+
+			if(!(p.revents&POLLIN))
+			{
+				fprintf(stderr,"Warning: no data after poll\n");
+				break;
+			}
+
+			while(1)
+			{
+				rxhdr=(struct tpacket2_hdr *)rx->data[rx->index];
+				if(!(rxhdr->tp_status&TP_STATUS_USER))break;
+				clock_gettime(CLOCK_MONOTONIC,&tm);
+				data=(struct probe *)(rx->data[rx->index]+rx->doff);
+
+				if(data->seq!=seq||data->cls>=ncls||
+					(got&(1<<data->cls)))
+				{
+					fprintf(stderr,"Warning: stale data skipped\n");
+				}
+				else switch(tsdiff(&tm,&data->ts,&val))
+				{
+				case -1:fprintf(stderr,"time mismatch, aborting\n");
+					return -1;
+				case 1:	fprintf(stderr,
+						"Warning: wrong data skipped\n");
+					break;
+				default:got|=1<<data->cls;
+					if(m.pre)break;
+					m.chg|=statsample(&st[data->cls],val);
+					if(capwant(&st[data->cls],val))capl2(cap,
+						tx,slot[data->cls],rxhdr,
+						&data->ts,&tm,val);
+				}
+
+				rxhdr->tp_status=TP_STATUS_KERNEL;
+				if((rx->index+=1)==rx->total)rx->index=0;
+			}
+		}
+
+		if(stop)break;
+
+		if(!m.pre)for(i=0;i<ncls;i++)if(!(got&(1<<i)))statlost(&st[i]);
+		measend(&m,st,got==all);
+
+skip:		seq++;
+		if(dly)usleep(dly);
+	}
+	return 0;
+}
+
+static char *addrstr(struct sockaddr_storage *ss,char *bfr)
+{
+	unsigned char *m=((struct sockaddr_ll *)ss)->sll_addr;
+
+	if(ss->ss_family==AF_PACKET)sprintf(bfr,
+		"%02x:%02x:%02x:%02x:%02x:%02x",m[0],m[1],m[2],m[3],m[4],m[5]);
+	else if(ss->ss_family==AF_INET)inet_ntop(AF_INET,
+		&((struct sockaddr_in *)ss)->sin_addr,bfr,INET6_ADDRSTRLEN);
+	else inet_ntop(AF_INET6,&((struct sockaddr_in6 *)ss)->sin6_addr,bfr,
+		INET6_ADDRSTRLEN);
+	return bfr;
+}
+
+static int addrcmp(struct sockaddr_storage *a,struct sockaddr_storage *b)
+{
+	if(a->ss_family!=b->ss_family)return -1;
+	if(a->ss_family==AF_PACKET)return memcmp(
+		((struct sockaddr_ll *)a)->sll_addr,
+		((struct sockaddr_ll *)b)->sll_addr,ETH_ALEN);
+	if(a->ss_family==AF_INET)return memcmp(
+		&((struct sockaddr_in *)a)->sin_addr,
+		&((struct sockaddr_in *)b)->sin_addr,4);
+	return memcmp(&((struct sockaddr_in6 *)a)->sin6_addr,
+		&((struct sockaddr_in6 *)b)->sin6_addr,16);
+}
+
+static void rstpeer(struct rstat *r,struct sockaddr_storage *ss)
+{
+	int i;
+
+	for(i=0;i<r->npeer;i++)if(!addrcmp(&r->peer[i].ss,ss))
+	{
+		r->peer[i].n++;
+		return;
+	}
+	if(r->npeer==MAXPEER)
+	{
+		r->other++;
+		return;
+	}
+	r->peer[r->npeer].ss=*ss;
+	r->peer[r->npeer++].n=1;
+}
+
+/* turnaround counts from the kernel receive stamp until the reply was
+   handed back to the kernel, both CLOCK_REALTIME */
+static void rstturn(struct rstat *r,struct timespec *rx)
+{
+	struct timespec now;
+	uint64_t t;
+
+	r->refl++;
+	if(!rx->tv_sec)return;
+	clock_gettime(CLOCK_REALTIME,&now);
+	if((t=tsns(&now))>tsns(rx))statadd(&r->turn,t-tsns(rx));
+}
+
+static void rstprint(struct rstat *r,uint64_t now)
+{
+	int i;
+	uint64_t dt=now-r->last;
+	char addr[INET6_ADDRSTRLEN];
+
+	if(!dt)dt=1;
+	printf("reflected %llu (%llu/s) tx full %llu enobufs %llu errors %llu "
+		"wakeups %llu batch %.2f/%llu\n",(unsigned long long)r->refl,
+		(unsigned long long)((r->refl-r->lrefl)*1000000000ULL/dt),
+		(unsigned long long)r->full,(unsigned long long)r->nobufs,
+		(unsigned long long)r->err,(unsigned long long)r->wake,
+		r->wake?(double)r->frames/r->wake:0.0,
+		(unsigned long long)r->bmax);
+	if(r->turn.n)printf("turnaround %llu/%llu/%llu/%llu ns\n",
+		(unsigned long long)r->turn.min,
+		(unsigned long long)(r->turn.sum/r->turn.n),
+		(unsigned long long)statpct(&r->turn,99.0),
+		(unsigned long long)r->turn.max);
+	for(i=0;i<r->npeer;i++)
+	{
+		printf("peer %s %llu (%llu/s)\n",addrstr(&r->peer[i].ss,addr),
+			(unsigned long long)r->peer[i].n,
+			(unsigned long long)((r->peer[i].n-r->peer[i].last)*
+			1000000000ULL/dt));
+		r->peer[i].last=r->peer[i].n;
+	}
+	if(r->other)printf("peer other %llu (%llu/s)\n",
+		(unsigned long long)r->other,
+		(unsigned long long)((r->other-r->lother)*1000000000ULL/dt));
+	fflush(stdout);
+	r->lrefl=r->refl;
+	r->lother=r->other;
+	r->last=now;
+}
+
+/* returns the poll timeout until the next periodic report */
+static int rstcheck(struct rstat *r)
+{
+	uint64_t now;
+	struct timespec tm;
+
+	clock_gettime(CLOCK_MONOTONIC,&tm);
+	now=tsns(&tm);
+	if(!r->last)
+	{
+		r->last=now;
+		r->next=now+r->period;
+	}
+	if(dump||(r->period&&now>=r->next))
+	{
+		dump=0;
+		rstprint(r,now);
+		if(r->period)while(r->next<=now)r->next+=r->period;
+	}
+	return r->period?(int)((r->next-now)/1000000+1):-1;
+}
+
+static void l2responder(struct rxtx *rx,struct rxtx *tx,int prio,int vid,
+	int fast)
+{
+	struct pollfd p;
+	struct probe *data;
+	struct tpacket2_hdr *rxhdr;
+	struct tpacket2_hdr *txhdr;
+	struct ethhdr *rxe;
+	struct ethhdr *txe;
+	struct timespec rt;
+	struct sockaddr_storage ss;
+	uint64_t batch;
+	uint16_t vdata[2];
+
+	p.fd=rx->fd;
+	p.events=POLLIN;
+
+	memset(&ss,0,sizeof(ss));
+	ss.ss_family=AF_PACKET;
+
+	while(!stop)
+	{
+		if(poll(&p,1,rst?rstcheck(rst):-1)<1)continue;
+		if(!(p.revents&POLLIN))continue;
+
+		for(batch=0;;batch++)
+		{
+			rxhdr=(struct tpacket2_hdr *)rx->data[rx->index];
+			if(!(rxhdr->tp_status&TP_STATUS_USER))
+			{
+				if(rst)
+				{
+					rst->wake++;
+					rst->frames+=batch;
+					if(batch>rst->bmax)rst->bmax=batch;
+				}
+				break;
+			}
+			data=(struct probe *)(rx->data[rx->index]+rx->doff);
+
+			if(!(txhdr=txget(tx)))
+			{
+				fprintf(stderr, "Warning: tx queue full\n");
+				if(rst)rst->full++;
+				goto skip;
+			}
+
+			rxe=(struct ethhdr *)(rx->data[rx->index]+rx->hoff);
+			txe=(struct ethhdr *)(tx->data[tx->head]+tx->hoff);
+
+			memcpy(txe->h_source,rxe->h_dest,ETH_ALEN);
+			memcpy(txe->h_dest,rxe->h_source,ETH_ALEN);
+
+			/* multi class probes carry the priority to reflect */
+			if(prio||(data->flags&PROBE_PRIO))
+			{
+				vdata[0]=htobe16(((data->flags&PROBE_PRIO?
+					data->prio&7:prio)<<13)|(vid&0xfff));
+				vdata[1]=rxe->h_proto;
+				txe->h_proto=htobe16(ETH_P_8021Q);
+				memcpy(tx->data[tx->head]+tx->doff,vdata,4);
+				memcpy(tx->data[tx->head]+tx->doff+4,data,
+					sizeof(struct probe));
+			}
+			else
+			{
+				txe->h_proto=rxe->h_proto;
+				memcpy(tx->data[tx->head]+tx->doff,data,
+					sizeof(struct probe));
+			}
+			txhdr->tp_len=DATASIZE;
+			txhdr->tp_status=TP_STATUS_SEND_REQUEST;
+
+			if(txsend(tx,fast))
+			{
+				perror("Warning: send");
+				if(rst)rst->err++;
+			}
+			else if(rst)
+			{
+				rt.tv_sec=rxhdr->tp_sec;
+				rt.tv_nsec=rxhdr->tp_nsec;
+				rstturn(rst,&rt);
+				memcpy(((struct sockaddr_ll *)&ss)->sll_addr,
+					rxe->h_source,ETH_ALEN);
+				rstpeer(rst,&ss);
+			}
+
+			if((tx->head+=1)==tx->total)tx->head=0;
+
+skip:			rxhdr->tp_status=TP_STATUS_KERNEL;
+			if((rx->index+=1)==rx->total)rx->index=0;
+		}
+	}
+}
+
+/* launch times are kept on a grid of the probe interval, the probe
+   carries its launch time converted to CLOCK_MONOTONIC */
+static int schedsend(int us,void *bfr,int len,struct sockaddr_storage *ss,
+	struct timespec *data,struct txsched *t)
+{
+	uint64_t now;
+	uint64_t dt;
+	struct timespec tai;
+	struct timespec at;
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	union
+	{
+		struct cmsghdr align;
+		unsigned char bfr[CMSG_SPACE(sizeof(uint64_t))];
+	} cmsg;
+
+	clock_gettime(CLOCK_TAI,&tai);
+	clock_gettime(CLOCK_MONOTONIC,data);
+	now=tai.tv_sec*1000000000ULL+tai.tv_nsec;
+
+	if(!t->next)t->next=now+t->lead;
+	else if((t->next+=t->period)<now+t->lead)
+	{
+		if(t->period)t->next+=((now+t->lead-t->next)/t->period+1)*
+			t->period;
+		else t->next=now+t->lead;
+	}
+
+	dt=t->next-now+data->tv_nsec;
+	data->tv_sec+=dt/1000000000;
+	data->tv_nsec=dt%1000000000;
+
+	if(t->local)
+	{
+		at.tv_sec=t->next/1000000000;
+		at.tv_nsec=t->next%1000000000;
+		clock_nanosleep(CLOCK_TAI,TIMER_ABSTIME,&at,NULL);
+		return sendto(us,bfr,len,MSG_DONTWAIT,(struct sockaddr *)ss,
+			sizeof(struct sockaddr_storage));
+	}
+
+	iov.iov_base=bfr;
+	iov.iov_len=len;
+	memset(&mh,0,sizeof(mh));
+	mh.msg_name=ss;
+	mh.msg_namelen=sizeof(struct sockaddr_storage);
+	mh.msg_iov=&iov;
+	mh.msg_iovlen=1;
+	mh.msg_control=cmsg.bfr;
+	mh.msg_controllen=sizeof(cmsg.bfr);
+	cm=CMSG_FIRSTHDR(&mh);
+	cm->cmsg_level=SOL_SOCKET;
+	cm->cmsg_type=SCM_TXTIME;
+	cm->cmsg_len=CMSG_LEN(sizeof(uint64_t));
+	memcpy(CMSG_DATA(cm),&t->next,sizeof(uint64_t));
+	return sendmsg(us,&mh,MSG_DONTWAIT);
+}
+
+static inline __attribute__((always_inline)) int udploop(int us,int port,
+	struct sockaddr_storage *ss,struct txsched *sched,int ts,int dly,
+	int cont,struct stats *st,const int timed,const int wait,const int inst)
+{
+	int l;
+	struct sockaddr_in *s4=(struct sockaddr_in *)ss;
+	struct sockaddr_in6 *s6=(struct sockaddr_in6 *)ss;
+	struct timespec *data;
+	uint64_t val;
+	struct meas m={20,0,ts,cont,0,wait?0xf:0x7ff};
+	struct pollfd p;
+	struct timespec tm;
+	struct timespec rt;
+	unsigned char bfr[DATASIZE];
+
+	if(ss)
+	{
+		if(ss->ss_family==AF_INET)s4->sin_port=htobe16(port);
+		else s6->sin6_port=htobe16(port);
+	}
+
+	p.fd=us;
+	p.events=POLLIN|POLLHUP|POLLERR;
+
+	memset(bfr,0,sizeof(bfr));
+	data=(struct timespec *)bfr;
+
+	while(!stop)
+	{
+		if(inst&&tstx)clock_gettime(CLOCK_REALTIME,&rt);
+		if(timed)l=schedsend(us,bfr,sizeof(bfr),ss,data,sched);
+		else
+		{
+			clock_gettime(CLOCK_MONOTONIC,data);
+			l=sendto(us,bfr,sizeof(bfr),MSG_DONTWAIT,
+				(struct sockaddr *)ss,
+				ss?sizeof(struct sockaddr_storage):0);
+		}
+		if(l!=sizeof(bfr))
+		{
+			if(l<0)perror("Warning: sendto");
+			else fprintf(stderr,"Warning: sendto unspecified "
+				"error");
+			goto skip;
+		}
+		if(inst&&tstx)txsent(tstx,m.pre?NULL:&rt);
+
+		/* transmit stamps wake poll with POLLERR */
+		while((l=poll(&p,1,1000))>0&&inst&&tstx&&!(p.revents&POLLIN)&&
+			(p.revents&POLLERR)&&txdrain(us,tstx));
+
+		if(l<1)
+		{
+			if(stop)break;
+			fprintf(stderr,"Warning: poll timed out\n");
+			if(!m.pre)statlost(st);
+			goto skip;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC,&tm);
+
+		if(!(p.revents&POLLIN))
+		{
+			fprintf(stderr,"Warning: no data after poll\n");
+			goto skip;
+		}
+
+		if((l=recv(us,bfr,sizeof(bfr),MSG_DONTWAIT))<=0)
+		{
+			if(l<0)perror("recv");
+			else fprintf(stderr,"unspecified receive error\n");
+			return -1;
+		}
+
+		if(l!=DATASIZE)
+		{
+			fprintf(stderr,"Warning: unexpected data length\n");
+			goto skip;
+		}
+
+		switch(tsdiff(&tm,data,&val))
+		{
+		case -1:if(timed)fprintf(stderr,"reply before the scheduled "
+				"launch, no etf qdisc?, aborting\n");
+			else fprintf(stderr,"time mismatch, aborting\n");
+			return -1;
+		case 1:	fprintf(stderr, "Warning: wrong data skipped\n");
+			break;
+		default:if(measure(&m,st,val)&&inst&&capwant(st,val))
+				capudp(cap,port,port,cap->tos,bfr,data,&tm,val);
+		}
+
+skip:		if(inst&&tstx)txdrain(us,tstx);
+		if(wait&&!timed)usleep(dly);
+	}
+	return 0;
+}
+
+#define UDPINIT(t,w,i)							\
+static int udpinit##t##w##i(int us,int port,struct sockaddr_storage *ss,	\
+	struct txsched *sched,int ts,int dly,int cont,struct stats *st)	\
+{									\
+	return udploop(us,port,ss,sched,ts,dly,cont,st,t,w,i);		\
+}
+
+UDPINIT(0,0,0) UDPINIT(0,0,1) UDPINIT(0,1,0) UDPINIT(0,1,1)
+UDPINIT(1,0,0) UDPINIT(1,0,1) UDPINIT(1,1,0) UDPINIT(1,1,1)
+
+static int (*const udpinit[8])(int us,int port,struct sockaddr_storage *ss,
+	struct txsched *sched,int ts,int dly,int cont,struct stats *st)=
+{
+	udpinit000,udpinit001,udpinit010,udpinit011,
+	udpinit100,udpinit101,udpinit110,udpinit111
+};
+
+static int udpinitiator(int us,int port,struct sockaddr_storage *ss,
+	struct txsched *sched,int ts,int dly,int cont,struct stats *st)
+{
+	return udpinit[(sched?4:0)|(dly?2:0)|(cap||tstx?1:0)](us,port,ss,
+		sched,ts,dly,cont,st);
+}
+
+static int udpclsinitiator(int *us,int *cls,int ncls,int port,
+	struct sockaddr_storage *ss,int ts,int dly,int cont,struct stats *st)
+{
+	int i;
+	int k;
+	int l;
+	int got;
+	int all=(1<<ncls)-1;
+	int tmo;
+	uint32_t seq=0;
+	uint64_t val;
+	struct meas m={20,0,ts,cont,0,dly?0xf:0x7ff,ncls};
+	struct sockaddr_in *s4=(struct sockaddr_in *)ss;
+	struct sockaddr_in6 *s6=(struct sockaddr_in6 *)ss;
+	struct probe *data;
+	struct pollfd p[MAXCLASS];
+	struct timespec tm;
+	struct timespec end;
+	unsigned char bfr[DATASIZE];
+
+	if(ss->ss_family==AF_INET)s4->sin_port=htobe16(port);
+	else s6->sin6_port=htobe16(port);
+
+	for(i=0;i<ncls;i++)
+	{
+		p[i].fd=us[i];
+		p[i].events=POLLIN|POLLHUP|POLLERR;
+	}
+
+	memset(bfr,0,sizeof(bfr));
+	data=(struct probe *)bfr;
+
+	while(!stop)
+	{
+		/* rotate the burst order so that no class is always sent
+		   first or processed last */
+		for(got=all,i=0;i<ncls;i++)
+		{
+			k=(seq+i)%ncls;
+			data->seq=seq;
+			data->cls=k;
+			data->flags=PROBE_DSCP;
+			data->dscp=cls[k];
+			clock_gettime(CLOCK_MONOTONIC,&data->ts);
+			if((l=sendto(us[k],bfr,sizeof(bfr),MSG_DONTWAIT,
+				(struct sockaddr *)ss,
+				sizeof(struct sockaddr_storage)))!=sizeof(bfr))
+			{
+				if(l<0)perror("Warning: sendto");
+				else fprintf(stderr,"Warning: sendto "
+					"unspecified error");
+			}
+			else got&=~(1<<k);
+		}
+
+		/* unsent classes are lost, the others are still awaited */
+		if(!m.pre)for(i=0;i<ncls;i++)if(got&(1<<i))statlost(&st[i]);
+		if(got==all)goto skip;
+
+		clock_gettime(CLOCK_MONOTONIC,&end);
+		end.tv_sec++;
+
+		while(got!=all)
+		{
+			clock_gettime(CLOCK_MONOTONIC,&tm);
+			if(tsdiff(&end,&tm,&val))tmo=0;
+			else tmo=val/1000000;
+
+			if(poll(p,ncls,tmo)<1)
+			{
+				if(!stop)fprintf(stderr,
+					"Warning: poll timed out\n");
+				break;
+			}
+
+			for(k=0;k<ncls;k++)
+			{
+				if(!p[k].revents)continue;
+				clock_gettime(CLOCK_MONOTONIC,&tm);
+
+				if(!(p[k].revents&POLLIN))
+				{
+					fprintf(stderr,
+						"Warning: no data after poll\n");
+					goto skip;
+				}
+
+				if((l=recv(us[k],bfr,sizeof(bfr),
+					MSG_DONTWAIT))<=0)
+				{
+					if(l<0)perror("recv");
+					else fprintf(stderr,
+						"unspecified receive error\n");
+					return -1;
+				}
+
+				if(l!=DATASIZE)
+				{
+					fprintf(stderr,"Warning: unexpected "
+						"data length\n");
+					continue;
+				}
+
+				if(data->seq!=seq||data->cls!=k||(got&(1<<k)))
+				{
+					fprintf(stderr,"Warning: stale data "
+						"skipped\n");
+					continue;
+				}
+
+				switch(tsdiff(&tm,&data->ts,&val))
+				{
+				case -1:fprintf(stderr,"time mismatch, "
+						"aborting\n");
+					return -1;
+				case 1:	fprintf(stderr,
+						"Warning: wrong data skipped\n");
+					break;
+				default:got|=1<<k;
+					if(m.pre)break;
+					m.chg|=statsample(&st[k],val);
+					if(capwant(&st[k],val))capudp(cap,
+						port+k,port,(cls[k]<<2)&0xfc,
+						bfr,&data->ts,&tm,val);
+				}
+			}
+		}
+
+		if(stop)break;
+
+		if(!m.pre)for(i=0;i<ncls;i++)if(!(got&(1<<i)))statlost(&st[i]);
+		measend(&m,st,got==all);
+
+skip:		seq++;
+		if(dly)usleep(dly);
+	}
+	return 0;
+}
+
+/* the reply of each flow is accounted to the receive queue and core the
+   kernel processed it on, queues are labelled in the order first seen,
+   a lost probe counts on the queue of the last reply of its flow or on
+   the first queue if the flow never got a reply */
+static int udpqinitiator(int *us,int nflow,int port,
+	struct sockaddr_storage *ss,int ts,int dly,int cont,struct stats *st)
+{
+	int i;
+	int l;
+	int k=0;
+	int nq=0;
+	int qcpu;
+	unsigned int napi=0;
+	socklen_t sl;
+	struct sockaddr_in *s4=(struct sockaddr_in *)ss;
+	struct sockaddr_in6 *s6=(struct sockaddr_in6 *)ss;
+	struct probe *data;
+	uint64_t val;
+	uint64_t key[MAXSTATS];
+	struct meas m={20,0,ts,cont,0,dly?0xf:0x7ff,0};
+	int fq[MAXFLOW];
+	struct pollfd p;
+	struct timespec tm;
+	unsigned char bfr[DATASIZE];
+
+	memset(fq,0,sizeof(fq));
+	if(ss->ss_family==AF_INET)s4->sin_port=htobe16(port);
+	else s6->sin6_port=htobe16(port);
+
+	/* the kernel only records core and napi id for connected sockets */
+	for(i=0;i<nflow;i++)if(connect(us[i],(struct sockaddr *)ss,
+		sizeof(struct sockaddr_storage)))
+	{
+		perror("connect");
+		return -1;
+	}
+
+	p.events=POLLIN|POLLHUP|POLLERR;
+
+	memset(bfr,0,sizeof(bfr));
+	data=(struct probe *)bfr;
+
+	while(!stop)
+	{
+		p.fd=us[k];
+		clock_gettime(CLOCK_MONOTONIC,&data->ts);
+		if((l=send(us[k],bfr,sizeof(bfr),MSG_DONTWAIT))!=sizeof(bfr))
+		{
+			if(l<0)perror("Warning: send");
+			else fprintf(stderr,"Warning: send unspecified error");
+			goto skip;
+		}
+
+		if(poll(&p,1,1000)<1)
+		{
+			if(stop)break;
+			fprintf(stderr,"Warning: poll timed out\n");
+			if(!m.pre)statlost(&st[fq[k]]);
+			goto skip;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC,&tm);
+
+		if(!(p.revents&POLLIN))
+		{
+			fprintf(stderr,"Warning: no data after poll\n");
+			if(!m.pre)statlost(&st[fq[k]]);
+			goto skip;
+		}
+
+		if((l=recv(us[k],bfr,sizeof(bfr),MSG_DONTWAIT))<=0)
+		{
+			if(l<0)perror("recv");
+			else fprintf(stderr,"unspecified receive error\n");
+			return -1;
+		}
+
+		if(l!=DATASIZE)
+		{
+			fprintf(stderr,"Warning: unexpected data length\n");
+			goto skip;
+		}
+
+		switch(tsdiff(&tm,&data->ts,&val))
+		{
+		case -1:fprintf(stderr,"time mismatch, aborting\n");
+			return -1;
+		case 1:	fprintf(stderr, "Warning: wrong data skipped\n");
+			goto skip;
+		}
+
+		if(measpre(&m))goto skip;
+
+		sl=sizeof(qcpu);
+		if(getsockopt(us[k],SOL_SOCKET,SO_INCOMING_CPU,&qcpu,&sl))
+			qcpu=-1;
+#ifdef SO_INCOMING_NAPI_ID
+		sl=sizeof(napi);
+		if(getsockopt(us[k],SOL_SOCKET,SO_INCOMING_NAPI_ID,&napi,&sl))
+			napi=0;
+#endif
+		for(i=0;i<nq;i++)if(key[i]==(((uint64_t)napi<<32)|
+			(uint32_t)qcpu))break;
+		if(i==nq)
+		{
+			if(nq==MAXSTATS)
+			{
+				fprintf(stderr,"Warning: too many queues, sample "
+					"skipped\n");
+				goto skip;
+			}
+			/* the reporter only prints labels below the count
+			   of a later print request, so the ring publishes
+			   the label before it is read */
+			key[nq]=((uint64_t)napi<<32)|(uint32_t)qcpu;
+			if(napi)snprintf(label[nq],sizeof(label[nq]),"c%d/n%u",
+				qcpu,napi);
+			else snprintf(label[nq],sizeof(label[nq]),"c%d",qcpu);
+			m.nst=++nq;
+		}
+		fq[k]=i;
+
+		m.chg|=statsample(&st[i],val);
+		measround(&m,st);
+
+skip:		if(++k==nflow)k=0;
+		if(dly)usleep(dly);
+	}
+	return 0;
+}
+
+/* the first slot of st is the last responder of a round, the others
+   belong to the responders in the order they were first seen */
+static int mcinitiator(int us,int port,struct sockaddr_storage *ss,
+	int nresp,struct sockaddr_storage *resp,int ts,int dly,int cont,
+	struct stats *st)
+{
+	int i;
+	int l;
+	int known=0;
+	int tmo;
+	uint32_t got;
+	uint32_t all=(nresp==32?0:(1U<<nresp))-1;
+	uint32_t seq=0;
+	uint64_t val;
+	uint64_t last;
+	struct meas m={20,0,ts,cont,0,dly?0xf:0x7ff,nresp+1};
+	socklen_t sl;
+	struct sockaddr_storage from;
+	struct sockaddr_in *s4=(struct sockaddr_in *)ss;
+	struct sockaddr_in6 *s6=(struct sockaddr_in6 *)ss;
+	struct probe *data;
+	struct pollfd p;
+	struct timespec tm;
+	struct timespec end;
+	unsigned char bfr[DATASIZE];
+	char addr[INET6_ADDRSTRLEN];
+
+	if(ss->ss_family==AF_INET)s4->sin_port=htobe16(port);
+	else s6->sin6_port=htobe16(port);
+
+	p.fd=us;
+	p.events=POLLIN|POLLHUP|POLLERR;
+
+	memset(bfr,0,sizeof(bfr));
+	data=(struct probe *)bfr;
+
+	while(!stop)
+	{
+		data->seq=seq;
+		clock_gettime(CLOCK_MONOTONIC,&data->ts);
+		if((l=sendto(us,bfr,sizeof(bfr),MSG_DONTWAIT,
+			(struct sockaddr *)ss,sizeof(struct sockaddr_storage)))!=
+			sizeof(bfr))
+		{
+			if(l<0)perror("Warning: sendto");
+			else fprintf(stderr,"Warning: sendto unspecified "
+				"error");
+			goto skip;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC,&end);
+		end.tv_sec++;
+
+		for(got=0,last=0;got!=all;)
+		{
+			clock_gettime(CLOCK_MONOTONIC,&tm);
+			if(tsdiff(&end,&tm,&val))tmo=0;
+			else tmo=val/1000000;
+
+			if(poll(&p,1,tmo)<1)
+			{
+				if(!stop)fprintf(stderr,
+					"Warning: poll timed out\n");
+				break;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC,&tm);
+
+			if(!(p.revents&POLLIN))
+			{
+				fprintf(stderr,"Warning: no data after poll\n");
+				break;
+			}
+
+			sl=sizeof(from);
+			if((l=recvfrom(us,bfr,sizeof(bfr),MSG_DONTWAIT,
+				(struct sockaddr *)&from,&sl))<=0)
+			{
+				if(l<0)perror("recvfrom");
+				else fprintf(stderr,
+					"unspecified receive error\n");
+				return -1;
+			}
+
+			if(l!=DATASIZE)
+			{
+				fprintf(stderr,"Warning: unexpected data "
+					"length\n");
+				continue;
+			}
+
+			for(i=0;i<known;i++)if(!addrcmp(&resp[i],&from))
+				break;
+			if(i==known)
+			{
+				if(known==nresp)
+				{
+					fprintf(stderr,"Warning: reply from "
+						"unexpected responder %s\n",
+						addrstr(&from,addr));
+					continue;
+				}
+				resp[known++]=from;
+				fprintf(stderr,"responder %d is %s\n",known,
+					addrstr(&from,addr));
+			}
+
+			if(data->seq!=seq||(got&(1U<<i)))
+			{
+				fprintf(stderr,"Warning: stale data skipped\n");
+				continue;
+			}
+
+			switch(tsdiff(&tm,&data->ts,&val))
+			{
+			case -1:fprintf(stderr,"time mismatch, aborting\n");
+				return -1;
+			case 1:	fprintf(stderr,"Warning: wrong data skipped\n");
+				break;
+			default:got|=1U<<i;
+				if(val>last)last=val;
+				if(!m.pre)m.chg|=statsample(&st[i+1],val);
+			}
+		}
+
+		if(stop)break;
+
+		if(!m.pre)
+		{
+			for(i=0;i<nresp;i++)if(!(got&(1U<<i)))
+				statlost(&st[i+1]);
+			if(got==all)m.chg|=statsample(st,last);
+			else statlost(st);
+		}
+		measend(&m,st,got==all);
+
+skip:		seq++;
+		if(dly)usleep(dly);
+	}
+	return 0;
+}
+
+static int epopen(int bpoll)
+{
+	int ep;
+	struct epoll_params prm;
+
+	if((ep=epoll_create1(EPOLL_CLOEXEC))==-1)
+	{
+		perror("epoll_create1");
+		return -1;
+	}
+	if(bpoll)
+	{
+		memset(&prm,0,sizeof(prm));
+		prm.busy_poll_usecs=bpoll;
+		prm.busy_poll_budget=64;
+		prm.prefer_busy_poll=1;
+		if(ioctl(ep,EPIOCSPARAMS,&prm))
+			perror("Warning: epoll busy poll");
+	}
+	return ep;
+}
+
+static int epadd(int ep,int fd,void *ptr,int bpoll)
+{
+	struct epoll_event ev;
+
+#ifdef SO_PREFER_BUSY_POLL
+	if(bpoll)if(setsockopt(fd,SOL_SOCKET,SO_PREFER_BUSY_POLL,&bpoll,
+		sizeof(bpoll)))perror("Warning: prefer busy poll");
+#endif
+	ev.events=EPOLLIN;
+	ev.data.ptr=ptr;
+	if(epoll_ctl(ep,EPOLL_CTL_ADD,fd,&ev))
+	{
+		perror("epoll_ctl");
+		return -1;
+	}
+	return 0;
+}
+
+static void udpresponder(int *usl,int n,int bpoll)
+{
+	int i;
+	int l;
+	int us;
+	int ep;
+	socklen_t sl;
+	struct epoll_event ev;
+	struct sockaddr_storage ss;
+	struct sockaddr_in *s4=(struct sockaddr_in *)&ss;
+	struct sockaddr_in6 *s6=(struct sockaddr_in6 *)&ss;
+	struct sockaddr_in tmp;
+	struct probe *data;
+	struct msghdr mh;
+	struct msghdr rmh;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	struct cmsghdr *rcm;
+	struct timespec rt;
+	union
+	{
+		struct cmsghdr align;
+		unsigned char bfr[CMSG_SPACE(sizeof(int))];
+	} cmsg;
+	union
+	{
+		struct cmsghdr align;
+		unsigned char bfr[CMSG_SPACE(sizeof(struct timespec))];
+	} rcmsg;
+	unsigned char bfr[DATASIZE];
+
+	if((ep=epopen(bpoll))==-1)return;
+	for(i=0;i<n;i++)if(epadd(ep,usl[i],&usl[i],bpoll))
+	{
+		close(ep);
+		return;
+	}
+
+	memset(&tmp,0,sizeof(tmp));
+	tmp.sin_family=AF_INET;
+
+	data=(struct probe *)bfr;
+	iov.iov_base=bfr;
+	iov.iov_len=sizeof(bfr);
+	memset(&mh,0,sizeof(mh));
+	mh.msg_name=&ss;
+	mh.msg_namelen=sizeof(ss);
+	mh.msg_iov=&iov;
+	mh.msg_iovlen=1;
+	mh.msg_control=cmsg.bfr;
+	mh.msg_controllen=sizeof(cmsg.bfr);
+	cm=CMSG_FIRSTHDR(&mh);
+	cm->cmsg_len=CMSG_LEN(sizeof(int));
+
+	rmh=mh;
+	rmh.msg_control=rcmsg.bfr;
+
+	while(!stop)
+	{
+		/* one socket per wakeup, the ready list is served round
+		   robin */
+		if(epoll_wait(ep,&ev,1,rst?rstcheck(rst):-1)<1)continue;
+		us=*((int *)ev.data.ptr);
+		if(ev.events&(EPOLLHUP|EPOLLERR))
+		{
+			fprintf(stderr,"socket error\n");
+			break;
+		}
+		if(!(ev.events&EPOLLIN))continue;
+		if(rst)
+		{
+			rst->wake++;
+			rmh.msg_namelen=sizeof(ss);
+			rmh.msg_controllen=sizeof(rcmsg.bfr);
+			l=recvmsg(us,&rmh,MSG_DONTWAIT);
+		}
+		else
+		{
+			sl=sizeof(struct sockaddr_storage);
+			l=recvfrom(us,bfr,sizeof(bfr),MSG_DONTWAIT,
+				(struct sockaddr *)&ss,&sl);
+		}
+		if(l<=0)
+		{
+			if(l<0)perror("recvfrom");
+			else fprintf(stderr,"unspecified receive error\n");
+			break;
+		}
+
+		if(l!=DATASIZE)
+		{
+			fprintf(stderr,"Warning: unexpected data length\n");
+			continue;
+		}
+
+		if(ss.ss_family==AF_INET6)if(!memcmp(s6->sin6_addr.s6_addr,
+			"\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\xff\xff",12))
+		{
+			memcpy(&tmp.sin_addr.s_addr,s6->sin6_addr.s6_addr+12,4);
+			tmp.sin_port=s6->sin6_port;
+			*s4=tmp;
+		}
+
+		/* multi class probes carry the DSCP value to reflect */
+		if(data->flags&PROBE_DSCP)
+		{
+			if(ss.ss_family==AF_INET)
+			{
+				cm->cmsg_level=IPPROTO_IP;
+				cm->cmsg_type=IP_TOS;
+			}
+			else
+			{
+				cm->cmsg_level=IPPROTO_IPV6;
+				cm->cmsg_type=IPV6_TCLASS;
+			}
+			*((int *)CMSG_DATA(cm))=(data->dscp<<2)&0xfc;
+			l=sendmsg(us,&mh,MSG_DONTWAIT);
+		}
+		else l=sendto(us,bfr,sizeof(bfr),MSG_DONTWAIT,
+			(struct sockaddr *)&ss,sizeof(ss));
+
+		if(l!=sizeof(bfr))
+		{
+			if(l<0)perror("Warning: sendto");
+			else fprintf(stderr,"Warning: unspecified sendto "
+				"error\n");
+			if(rst)
+			{
+				if(l<0&&errno==ENOBUFS)rst->nobufs++;
+				else rst->err++;
+			}
+		}
+		else if(rst)
+		{
+			rst->frames++;
+			if(!rst->bmax)rst->bmax=1;
+			memset(&rt,0,sizeof(rt));
+			for(rcm=CMSG_FIRSTHDR(&rmh);rcm;rcm=CMSG_NXTHDR(&rmh,rcm))
+				if(rcm->cmsg_level==SOL_SOCKET&&
+				rcm->cmsg_type==SCM_TIMESTAMPNS)
+				memcpy(&rt,CMSG_DATA(rcm),sizeof(rt));
+			rstturn(rst,&rt);
+			rstpeer(rst,&ss);
+		}
+	}
+
+	close(ep);
+}
+
+static int tcpinitiator(int s,int port,struct sockaddr_storage *ss,int ts,
+	int dly,int cont,int qack,struct stats *st)
+{
+	int l;
+	int len=0;
+	int one=1;
+	uint32_t seq=0;
+	uint64_t val;
+	struct meas m={20,0,ts,cont,0,dly?0xf:0x7ff};
+	socklen_t sl;
+	struct sockaddr_in *s4=(struct sockaddr_in *)ss;
+	struct sockaddr_in6 *s6=(struct sockaddr_in6 *)ss;
+	struct probe *data;
+	struct probe *reply;
+	struct pollfd p;
+	struct timespec tm;
+	unsigned char bfr[DATASIZE];
+	unsigned char rbfr[DATASIZE];
+
+	if(ss->ss_family==AF_INET)s4->sin_port=htobe16(port);
+	else s6->sin6_port=htobe16(port);
+
+	p.fd=s;
+	p.events=POLLOUT;
+
+	if(connect(s,(struct sockaddr *)ss,sizeof(struct sockaddr_storage))&&
+		errno!=EINPROGRESS)
+	{
+		perror("connect");
+		return -1;
+	}
+	if(poll(&p,1,5000)<1)
+	{
+		fprintf(stderr,"connect timed out\n");
+		return -1;
+	}
+	sl=sizeof(l);
+	if(getsockopt(s,SOL_SOCKET,SO_ERROR,&l,&sl)||l)
+	{
+		errno=l;
+		perror("connect");
+		return -1;
+	}
+
+	p.events=POLLIN|POLLHUP|POLLERR;
+
+	memset(bfr,0,sizeof(bfr));
+	data=(struct probe *)bfr;
+	reply=(struct probe *)rbfr;
+
+	while(!stop)
+	{
+		data->seq=++seq;
+		clock_gettime(CLOCK_MONOTONIC,&data->ts);
+		if((l=send(s,bfr,sizeof(bfr),MSG_DONTWAIT|MSG_NOSIGNAL))!=
+			sizeof(bfr))
+		{
+			if(l<0)perror("send");
+			else fprintf(stderr,"short send, aborting\n");
+			return -1;
+		}
+
+		/* replies to timed out probes arrive late on the stream
+		   and are skipped by sequence number */
+		while(1)
+		{
+			if(poll(&p,1,1000)<1)
+			{
+				if(stop)return 0;
+				fprintf(stderr,"Warning: poll timed out\n");
+				if(!m.pre)statlost(st);
+				goto skip;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC,&tm);
+
+			if(!(p.revents&POLLIN))
+			{
+				fprintf(stderr,"connection lost\n");
+				return -1;
+			}
+
+			if((l=recv(s,rbfr+len,sizeof(rbfr)-len,
+				MSG_DONTWAIT))<=0)
+			{
+				if(l<0&&errno==EAGAIN)continue;
+				if(l<0)perror("recv");
+				else fprintf(stderr,"connection closed\n");
+				return -1;
+			}
+			if(qack)setsockopt(s,IPPROTO_TCP,TCP_QUICKACK,&one,
+				sizeof(one));
+
+			if((len+=l)<DATASIZE)continue;
+			len=0;
+			if(reply->seq==seq)break;
+		}
+
+		switch(tsdiff(&tm,&reply->ts,&val))
+		{
+		case -1:fprintf(stderr,"time mismatch, aborting\n");
+			return -1;
+		case 1:	fprintf(stderr, "Warning: wrong data skipped\n");
+			break;
+		default:measure(&m,st,val);
+		}
+
+skip:		if(dly)usleep(dly);
+	}
+	return 0;
+}
+
+static void tcpresponder(int ls,int qack)
+{
+	int s;
+	int l;
+	int len;
+	int one=1;
+	struct pollfd p;
+	unsigned char bfr[DATASIZE];
+
+	while(!stop)
+	{
+		p.fd=ls;
+		p.events=POLLIN;
+		if(poll(&p,1,-1)<1)continue;
+		if((s=accept4(ls,NULL,NULL,SOCK_NONBLOCK|SOCK_CLOEXEC))==-1)
+		{
+			perror("Warning: accept");
+			continue;
+		}
+		if(setsockopt(s,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one)))
+			perror("Warning: setsockopt");
+
+		p.fd=s;
+		p.events=POLLIN|POLLHUP|POLLERR;
+
+		for(len=0;!stop;)
+		{
+			if(poll(&p,1,-1)<1)continue;
+			if(!(p.revents&POLLIN))break;
+			if((l=recv(s,bfr+len,sizeof(bfr)-len,MSG_DONTWAIT))<=0)
+			{
+				if(l<0&&errno==EAGAIN)continue;
+				break;
+			}
+			if(qack)setsockopt(s,IPPROTO_TCP,TCP_QUICKACK,&one,
+				sizeof(one));
+
+			if((len+=l)<DATASIZE)continue;
+			len=0;
+
+			if((l=send(s,bfr,sizeof(bfr),MSG_DONTWAIT|
+				MSG_NOSIGNAL))!=sizeof(bfr))
+			{
+				if(l<0)perror("Warning: send");
+				else fprintf(stderr,"Warning: short send\n");
+				break;
+			}
+		}
+
+		close(s);
+	}
+}
+
+static int clkinitiator(int ts,int dly,int cont,struct stats *st)
+{
+	uint64_t val;
+	struct meas m={20,0,ts,cont,0,dly?0xf:0x7ff};
+	struct timespec t0;
+	struct timespec tm;
+
+	while(!stop)
+	{
+		clock_gettime(CLOCK_MONOTONIC,&t0);
+		clock_gettime(CLOCK_MONOTONIC,&tm);
+
+		if(tsdiff(&tm,&t0,&val))
+		{
+			fprintf(stderr,"time mismatch, aborting\n");
+			return -1;
+		}
+		measure(&m,st,val);
+
+		if(dly)usleep(dly);
+	}
+	return 0;
+}
+
+static int shminitiator(struct shm *shm,int ts,int dly,int cont,
+	struct stats *st)
+{
+	uint32_t seq=0;
+	uint32_t spin;
+	uint64_t val;
+	struct meas m={20,0,ts,cont,0,dly?0xf:0x7ff};
+	struct timespec t0;
+	struct timespec tm;
+
+	while(!stop)
+	{
+		clock_gettime(CLOCK_MONOTONIC,&t0);
+		__atomic_store_n(&shm->req,++seq,__ATOMIC_RELEASE);
+
+		/* yield now and then so that a peer sharing the core can
+		   make progress */
+		for(spin=0;__atomic_load_n(&shm->ack,__ATOMIC_ACQUIRE)!=seq;)
+			if(!(++spin&0x3ff))
+		{
+			clock_gettime(CLOCK_MONOTONIC,&tm);
+			if(tsdiff(&tm,&t0,&val))
+			{
+				fprintf(stderr,"peer not responding, "
+					"aborting\n");
+				return -1;
+			}
+			sched_yield();
+		}
+
+		clock_gettime(CLOCK_MONOTONIC,&tm);
+
+		if(tsdiff(&tm,&t0,&val))
+			fprintf(stderr, "Warning: wrong data skipped\n");
+		else measure(&m,st,val);
+
+		if(dly)usleep(dly);
+	}
+	return 0;
+}
+
+static void shmresponder(struct shm *shm)
+{
+	uint32_t seq;
+	uint32_t last=0;
+	uint32_t spin=0;
+
+	while(!stop)
+	{
+		if((seq=__atomic_load_n(&shm->req,__ATOMIC_ACQUIRE))==last)
+		{
+			if(!(++spin&0x3ff))sched_yield();
+			continue;
+		}
+		__atomic_store_n(&shm->ack,last=seq,__ATOMIC_RELEASE);
+	}
+}
+
+static void unixresponder(int s)
+{
+	int l;
+	struct pollfd p;
+	unsigned char bfr[DATASIZE];
+
+	p.fd=s;
+	p.events=POLLIN|POLLHUP|POLLERR;
+
+	while(!stop)
+	{
+		if(poll(&p,1,-1)<1)continue;
+		if(!(p.revents&POLLIN))return;
+		if((l=recv(s,bfr,sizeof(bfr),MSG_DONTWAIT))<=0)
+		{
+			if(l<0&&errno==EAGAIN)continue;
+			return;
+		}
+		if(send(s,bfr,l,MSG_DONTWAIT)!=l)
+			perror("Warning: send");
+	}
+}
+
+static int loaddue(struct load *ld,struct timespec *start,uint64_t sent)
+{
+	uint64_t due;
+	struct timespec tm;
+
+	if(!ld->rate)return LOADBATCH;
+
+	clock_gettime(CLOCK_MONOTONIC,&tm);
+	if(tm.tv_nsec<start->tv_nsec)
+	{
+		tm.tv_nsec+=1000000000;
+		tm.tv_sec--;
+	}
+	due=(tm.tv_sec-start->tv_sec)*ld->rate+
+		(tm.tv_nsec-start->tv_nsec)*(uint64_t)ld->rate/1000000000;
+	if(due<=sent)return 0;
+	if(due-sent>LOADBATCH)return LOADBATCH;
+	return due-sent;
+}
+
+static void *l2load(void *arg)
+{
+	struct load *ld=arg;
+	struct tpacket2_hdr *txhdr;
+	struct ethhdr *txe;
+	int i;
+	int n;
+	int l;
+	uint16_t vdata[2];
+	uint64_t sent=0;
+	struct timespec start;
+
+	vdata[0]=htobe16(ld->vid&0xfff);
+	vdata[1]=htobe16(ETH_P_LOAD);
+
+	for(i=0;i<ld->tx->total;i++)
+	{
+		txe=(struct ethhdr *)(ld->tx->data[i]+ld->tx->hoff);
+		memcpy(txe->h_source,ld->src,ETH_ALEN);
+		memcpy(txe->h_dest,ld->dst,ETH_ALEN);
+		if(ld->tag)
+		{
+			txe->h_proto=htobe16(ETH_P_8021Q);
+			memcpy(ld->tx->data[i]+ld->tx->doff,vdata,4);
+		}
+		else txe->h_proto=htobe16(ETH_P_LOAD);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&start);
+
+	while(1)
+	{
+		if(!(n=loaddue(ld,&start,sent)))
+		{
+			usleep(ld->rate>1000000?1:1000000/ld->rate);
+			continue;
+		}
+
+		for(i=0;i<n;i++)
+		{
+			if(!(txhdr=txget(ld->tx)))break;
+			txhdr->tp_len=ld->size;
+			txhdr->tp_status=TP_STATUS_SEND_REQUEST;
+			if((ld->tx->head+=1)==ld->tx->total)ld->tx->head=0;
+		}
+		sent+=i;
+
+		if((l=send(ld->tx->fd,NULL,0,MSG_DONTWAIT))<0)
+		{
+			if(errno!=ENOBUFS&&errno!=EAGAIN)
+			{
+				perror("load send");
+				return NULL;
+			}
+			usleep(10);
+		}
+		else if(l)
+		{
+			__atomic_add_fetch(&ld->pkts,l/ld->size,
+				__ATOMIC_RELAXED);
+			__atomic_add_fetch(&ld->bytes,l,__ATOMIC_RELAXED);
+		}
+	}
+}
+
+static void *udpload(void *arg)
+{
+	struct load *ld=arg;
+	int i;
+	int n;
+	int l;
+	uint64_t sent=0;
+	struct pollfd p;
+	struct timespec start;
+	struct iovec iov;
+	struct mmsghdr mh[LOADBATCH];
+	unsigned char bfr[1500];
+
+	p.fd=ld->us;
+	p.events=POLLOUT;
+
+	memset(bfr,0,sizeof(bfr));
+	iov.iov_base=bfr;
+	iov.iov_len=ld->size;
+	memset(mh,0,sizeof(mh));
+	for(i=0;i<LOADBATCH;i++)
+	{
+		mh[i].msg_hdr.msg_name=&ld->ss;
+		mh[i].msg_hdr.msg_namelen=sizeof(ld->ss);
+		mh[i].msg_hdr.msg_iov=&iov;
+		mh[i].msg_hdr.msg_iovlen=1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&start);
+
+	while(1)
+	{
+		if(!(n=loaddue(ld,&start,sent)))
+		{
+			usleep(ld->rate>1000000?1:1000000/ld->rate);
+			continue;
+		}
+
+		if((l=sendmmsg(ld->us,mh,n,MSG_DONTWAIT))<0)
+		{
+			if(errno!=ENOBUFS&&errno!=EAGAIN)
+			{
+				perror("load sendmmsg");
+				return NULL;
+			}
+			poll(&p,1,10);
+			continue;
+		}
+		sent+=l;
+		__atomic_add_fetch(&ld->pkts,l,__ATOMIC_RELAXED);
+		__atomic_add_fetch(&ld->bytes,l*ld->size,__ATOMIC_RELAXED);
+	}
+}
+
+static int mac2bin(char *mac,unsigned char *hwaddr)
+{
+	int i;
+
+	for(i=0;i<ETH_ALEN;i++,mac+=3,hwaddr++)
+	{
+		switch(i)
+		{
+		case ETH_ALEN-1:
+			if(mac[2])return -1;
+			break;
+		default:if(mac[2]!=':')return -1;
+			break;
+		}
+		if(mac[0]>='0'&&mac[0]<='9')*hwaddr=mac[0]-'0';
+		else if(mac[0]>='A'&&mac[0]<='F')*hwaddr=mac[0]-'A'+10;
+		else if(mac[0]>='a'&&mac[0]<='f')*hwaddr=mac[0]-'a'+10;
+		else return -1;
+		*hwaddr<<=4;
+		if(mac[1]>='0'&&mac[1]<='9')*hwaddr|=mac[1]-'0';
+		else if(mac[1]>='A'&&mac[1]<='F')*hwaddr|=mac[1]-'A'+10;
+		else if(mac[1]>='a'&&mac[1]<='f')*hwaddr|=mac[1]-'a'+10;
+		else return -1;
+	}
+	return 0;
+}
+
+static int getmac(char *dev,unsigned char *addr)
+{
+	int s;
+	struct ifreq ifreq;
+
+	if((s=socket(AF_INET,SOCK_DGRAM,0))==-1)return -1;
+	memset(&ifreq,0,sizeof(ifreq));
+	strncpy(ifreq.ifr_name,dev,sizeof(ifreq.ifr_name)-1);
+	if(ioctl(s,SIOCGIFHWADDR,&ifreq))
+	{
+		close(s);
+		return -1;
+	}
+	close(s);
+	if(ifreq.ifr_hwaddr.sa_family!=ARPHRD_ETHER)return -1;
+	memcpy(addr,ifreq.ifr_hwaddr.sa_data,ETH_ALEN);
+	return 0;
+}
+
+static int getaddr(char *addr,struct sockaddr_storage *dest,int v4)
+{
+	int e;
+	struct hostent r;
+	struct hostent *res;
+	struct sockaddr_in *a4=(struct sockaddr_in *)dest;
+	struct sockaddr_in6 *a6=(struct sockaddr_in6 *)dest;
+	char bfr[8192];
+
+	memset(dest,0,sizeof(struct sockaddr_storage));
+
+	if(inet_pton(AF_INET,addr,&a4->sin_addr.s_addr)==1)goto chk4;
+	if(!v4)if(inet_pton(AF_INET6,addr,a6->sin6_addr.s6_addr)==1)goto chk6;
+	if(!v4)if(!gethostbyname2_r(addr,AF_INET6,&r,bfr,sizeof(bfr),&res,&e))
+		if(r.h_addrtype==AF_INET6)
+	{
+		memcpy(a6->sin6_addr.s6_addr,r.h_addr,16);
+		goto chk6;
+	}
+	if(!gethostbyname2_r(addr,AF_INET,&r,bfr,sizeof(bfr),&res,&e))
+		if(r.h_addrtype==AF_INET)
+	{
+		memcpy(&a4->sin_addr.s_addr,r.h_addr,4);
+		goto chk4;
+	}
+	return -1;
+
+chk4:	if(!memcmp(&a4->sin_addr.s_addr,"\x00\x00\x00\x00",4))return -1;
+	if(be32toh(a4->sin_addr.s_addr)>=0xe0000000)return -1;
+	a4->sin_family=AF_INET;
+	return 0;
+
+chk6:	if(memcmp(a6->sin6_addr.s6_addr,"\xfe\x80\x00\x00\x00\x00\x00\x00",8)&&
+		(a6->sin6_addr.s6_addr[0]&0xfe)!=0xfc&&
+		(a6->sin6_addr.s6_addr[0]&0xe0)!=0x20)return -1;
+	a6->sin6_family=AF_INET6;
+	return 0;
+}
+
+static int chkaddr(struct sockaddr_storage *ss,int local)
+{
+	if(ss->ss_family!=AF_INET6)return 0;
+	if(((struct sockaddr_in6 *)ss)->sin6_addr.s6_addr[0]==0xfe)
+	{
+		if(!local)return -1;
+	}
+	else if(local)return -1;
+	return 0;
+}
+
+static int getgroup(char *addr,struct sockaddr_storage *dest,int v4,
+	int local)
+{
+	struct sockaddr_in *a4=(struct sockaddr_in *)dest;
+	struct sockaddr_in6 *a6=(struct sockaddr_in6 *)dest;
+
+	memset(dest,0,sizeof(struct sockaddr_storage));
+
+	if(inet_pton(AF_INET,addr,&a4->sin_addr.s_addr)==1)
+	{
+		if((be32toh(a4->sin_addr.s_addr)>>28)!=0xe)return -1;
+		a4->sin_family=AF_INET;
+		return 0;
+	}
+	if(v4||inet_pton(AF_INET6,addr,a6->sin6_addr.s6_addr)!=1)return -1;
+	if(a6->sin6_addr.s6_addr[0]!=0xff)return -1;
+	if((a6->sin6_addr.s6_addr[1]&0xf)<=2&&!local)return -1;
+	a6->sin6_family=AF_INET6;
+	return 0;
+}
+
+/* responders join the group, the initiator only selects the outgoing
+   interface */
+static int mcsetup(int s,struct sockaddr_storage *grp,char *dev,int join)
+{
+	int idx=0;
+	struct ip_mreqn m4;
+	struct ipv6_mreq m6;
+
+	if(dev)if(!(idx=if_nametoindex(dev)))return -1;
+
+	if(grp->ss_family==AF_INET)
+	{
+		memset(&m4,0,sizeof(m4));
+		m4.imr_multiaddr=((struct sockaddr_in *)grp)->sin_addr;
+		m4.imr_ifindex=idx;
+		return setsockopt(s,IPPROTO_IP,join?IP_ADD_MEMBERSHIP:
+			IP_MULTICAST_IF,&m4,sizeof(m4));
+	}
+
+	if(!join)return setsockopt(s,IPPROTO_IPV6,IPV6_MULTICAST_IF,&idx,
+		sizeof(idx));
+	m6.ipv6mr_multiaddr=((struct sockaddr_in6 *)grp)->sin6_addr;
+	m6.ipv6mr_interface=idx;
+	return setsockopt(s,IPPROTO_IPV6,IPV6_JOIN_GROUP,&m6,sizeof(m6));
+}
+
+/* a classic pcap file only provides the timing and the wire length of
+   each packet, the content is not replayed */
+static struct tpkt *traceload(char *file,int *n)
+{
+	int i;
+	int sw;
+	int nsec;
+	int max=0;
+	uint32_t h[4];
+	uint32_t magic;
+	uint64_t t;
+	uint64_t first=0;
+	FILE *fp;
+	struct tpkt *pkt=NULL;
+	struct tpkt *tmp;
+	unsigned char hdr[24];
+
+	*n=0;
+	if(!(fp=fopen(file,"re")))goto err1;
+	if(fread(hdr,sizeof(hdr),1,fp)!=1)goto err2;
+	memcpy(&magic,hdr,4);
+	switch(magic)
+	{
+	case 0xa1b2c3d4:sw=0;
+		nsec=0;
+		break;
+	case 0xa1b23c4d:sw=0;
+		nsec=1;
+		break;
+	case 0xd4c3b2a1:sw=1;
+		nsec=0;
+		break;
+	case 0x4d3cb2a1:sw=1;
+		nsec=1;
+		break;
+	default:goto err2;
+	}
+
+	while(fread(h,sizeof(h),1,fp)==1)
+	{
+		if(sw)for(i=0;i<4;i++)h[i]=__builtin_bswap32(h[i]);
+		if(fseek(fp,h[2],SEEK_CUR))goto err3;
+		if(*n==max)
+		{
+			if(!(tmp=realloc(pkt,(max+=4096)*sizeof(struct tpkt))))
+				goto err3;
+			pkt=tmp;
+		}
+		t=h[0]*1000000000ULL+h[1]*(nsec?1ULL:1000ULL);
+		if(!*n)first=t;
+
+		/* reordered stamps are replayed back to back */
+		pkt[*n].at=t<first?0:t-first;
+		if(*n&&pkt[*n].at<pkt[*n-1].at)pkt[*n].at=pkt[*n-1].at;
+		pkt[(*n)++].len=h[3];
+	}
+	if(!*n)goto err3;
+
+	fclose(fp);
+	return pkt;
+
+err3:	free(pkt);
+	pkt=NULL;
+err2:	fclose(fp);
+err1:	fprintf(stderr,"Cannot read %s\n",file);
+	return pkt;
+}
+
+/* replayed probes do not wait for the reply of the previous one, a probe
+   is lost if its reply did not arrive before its slot is reused or
+   within the second the run keeps receiving after the last probe */
+static void replaysent(struct replay *r,uint64_t now)
+{
+	struct rslot *s=&r->win[r->seq&(REPLAYWIN-1)];
+
+	if(s->sent&&s->seq>=20)statlost(r->st);
+	s->sent=now;
+	s->seq=r->seq++;
+}
+
+static void replayack(struct replay *r,uint32_t seq,uint64_t now)
+{
+	struct rslot *s=&r->win[seq&(REPLAYWIN-1)];
+
+	if(!s->sent||s->seq!=seq||now<s->sent)return;
+	now-=s->sent;
+	s->sent=0;
+	if(seq>=20)measure(&r->m,r->st,now);
+}
+
+/* waits for replies until none is outstanding or end has passed,
+   returns 0 when done */
+static int replaywait(struct replay *r,struct pollfd *p,uint64_t end)
+{
+	int i;
+	uint64_t now;
+	struct timespec tm;
+
+	for(i=0;i<REPLAYWIN;i++)if(r->win[i].sent)break;
+	if(i==REPLAYWIN)return 0;
+	clock_gettime(CLOCK_MONOTONIC,&tm);
+	if((now=tsns(&tm))>=end)return 0;
+	tm.tv_sec=(end-now)/1000000000;
+	tm.tv_nsec=(end-now)%1000000000;
+	ppoll(p,1,&tm,NULL);
+	return 1;
+}
+
+static void replayend(struct replay *r)
+{
+	int i;
+
+	for(i=0;i<REPLAYWIN;i++)if(r->win[i].sent&&r->win[i].seq>=20)
+		statlost(r->st);
+	statreport(r->st,0,r->m.ts,r->m.cont,r->m.chg);
+}
+
+/* returns the time to wait until the next packet is due, 0 if it is */
+static uint64_t replaydue(struct replay *r,int i,uint64_t base,uint64_t now)
+{
+	return now<base+r->pkt[i].at?base+r->pkt[i].at-now:0;
+}
+
+static void udpacks(int us,struct replay *r)
+{
+	int l;
+	struct timespec tm;
+	unsigned char bfr[DATASIZE];
+
+	while((l=recv(us,bfr,sizeof(bfr),MSG_DONTWAIT))>=0)
+	{
+		clock_gettime(CLOCK_MONOTONIC,&tm);
+		if(l>=sizeof(struct probe))replayack(r,
+			((struct probe *)bfr)->seq,tsns(&tm));
+	}
+}
+
+static int udpreplay(int us,int port,struct sockaddr_storage *ss,
+	struct replay *r,int gap)
+{
+	int i=0;
+	int l;
+	int len;
+	int hl;
+	uint64_t base;
+	uint64_t wait;
+	struct sockaddr_in *s4=(struct sockaddr_in *)ss;
+	struct sockaddr_in6 *s6=(struct sockaddr_in6 *)ss;
+	struct probe *data;
+	struct pollfd p;
+	struct timespec tm;
+	unsigned char bfr[ETH_DATA_LEN-28];
+
+	if(ss->ss_family==AF_INET)
+	{
+		s4->sin_port=htobe16(port);
+		hl=ETH_HLEN+28;
+	}
+	else
+	{
+		s6->sin6_port=htobe16(port);
+		hl=ETH_HLEN+48;
+	}
+
+	p.fd=us;
+	p.events=POLLIN;
+
+	memset(bfr,0,sizeof(bfr));
+	data=(struct probe *)bfr;
+
+	clock_gettime(CLOCK_MONOTONIC,&tm);
+	base=tsns(&tm);
+
+	while(!stop)
+	{
+		udpacks(us,r);
+
+		clock_gettime(CLOCK_MONOTONIC,&tm);
+		if((wait=replaydue(r,i,base,tsns(&tm))))
+		{
+			tm.tv_sec=wait/1000000000;
+			tm.tv_nsec=wait%1000000000;
+			ppoll(&p,1,&tm,NULL);
+			continue;
+		}
+
+		len=r->pkt[i].len-hl;
+		if(len<DATASIZE)len=DATASIZE;
+		else if(len>sizeof(bfr))len=sizeof(bfr);
+
+		data->seq=r->seq;
+		clock_gettime(CLOCK_MONOTONIC,&data->ts);
+		replaysent(r,tsns(&data->ts));
+		if((l=sendto(us,bfr,len,MSG_DONTWAIT,(struct sockaddr *)ss,
+			sizeof(struct sockaddr_storage)))!=len)
+		{
+			if(l<0)perror("Warning: sendto");
+			else fprintf(stderr,"Warning: sendto unspecified "
+				"error");
+		}
+
+		if(++i==r->n)
+		{
+			base+=r->pkt[i-1].at+gap;
+			i=0;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&tm);
+	base=tsns(&tm)+1000000000ULL;
+	while(replaywait(r,&p,base))udpacks(us,r);
+	replayend(r);
+	return 0;
+}
+
+static void l2acks(struct rxtx *rx,struct replay *r)
+{
+	struct tpacket2_hdr *rxhdr;
+	struct probe *data;
+	struct timespec tm;
+
+	while(1)
+	{
+		rxhdr=(struct tpacket2_hdr *)rx->data[rx->index];
+		if(!(rxhdr->tp_status&TP_STATUS_USER))break;
+		clock_gettime(CLOCK_MONOTONIC,&tm);
+		data=(struct probe *)(rx->data[rx->index]+rx->doff);
+		replayack(r,data->seq,tsns(&tm));
+		rxhdr->tp_status=TP_STATUS_KERNEL;
+		if((rx->index+=1)==rx->total)rx->index=0;
+	}
+}
+
+static int l2replay(struct rxtx *tx,struct rxtx *rx,void *src,void *dst,
+	int prio,int vid,int fast,struct replay *r,int gap)
+{
+	int i=0;
+	int len;
+	int off;
+	uint64_t base;
+	uint64_t wait;
+	struct tpacket2_hdr *txhdr;
+	struct ethhdr *txe;
+	struct probe *data;
+	struct pollfd p;
+	struct timespec tm;
+	uint16_t vdata[2];
+
+	p.fd=rx->fd;
+	p.events=POLLIN;
+
+	vdata[0]=htobe16((prio<<13)|(vid&0xfff));
+	vdata[1]=htobe16(ETH_P_802_EX1);
+	off=prio?4:0;
+
+	clock_gettime(CLOCK_MONOTONIC,&tm);
+	base=tsns(&tm);
+
+	while(!stop)
+	{
+		l2acks(rx,r);
+
+		clock_gettime(CLOCK_MONOTONIC,&tm);
+		if((wait=replaydue(r,i,base,tsns(&tm))))
+		{
+			tm.tv_sec=wait/1000000000;
+			tm.tv_nsec=wait%1000000000;
+			ppoll(&p,1,&tm,NULL);
+			continue;
+		}
+
+		if(!(txhdr=txget(tx)))
+		{
+			fprintf(stderr,"transmit queue overflow\n");
+			return -1;
+		}
+
+		txe=(struct ethhdr *)(tx->data[tx->head]+tx->hoff);
+		memcpy(txe->h_source,src,ETH_ALEN);
+		memcpy(txe->h_dest,dst,ETH_ALEN);
+		if(prio)
+		{
+			txe->h_proto=htobe16(ETH_P_8021Q);
+			memcpy(tx->data[tx->head]+tx->doff,vdata,4);
+		}
+		else txe->h_proto=htobe16(ETH_P_802_EX1);
+
+		len=r->pkt[i].len;
+		if(len<DATASIZE)len=DATASIZE;
+		else if(len>ETH_FRAME_LEN)len=ETH_FRAME_LEN;
+
+		data=(struct probe *)(tx->data[tx->head]+tx->doff+off);
+		memset(data,0,sizeof(struct probe));
+		data->seq=r->seq;
+		clock_gettime(CLOCK_MONOTONIC,&data->ts);
+		replaysent(r,tsns(&data->ts));
+
+		txhdr->tp_len=len+off;
+		txhdr->tp_status=TP_STATUS_SEND_REQUEST;
+		if((tx->head+=1)==tx->total)tx->head=0;
+
+		switch(txsend(tx,fast))
+		{
+		case -1:perror("send\n");
+			return -1;
+		case 1:	perror("Warning: send");
+		}
+
+		if(++i==r->n)
+		{
+			base+=r->pkt[i-1].at+gap;
+			i=0;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&tm);
+	base=tsns(&tm)+1000000000ULL;
+	while(replaywait(r,&p,base))l2acks(rx,r);
+	replayend(r);
+	return 0;
+}
+
+/* one line per session: <host> <port> [<interval in ms>], the session
+   socket is connected and bound to an ephemeral port, the soft open file
+   limit is raised so that all sessions fit */
+static int sessload(char *file,int v4,char *dev,int udp,int dscp,int prio,
+	int cpu,int bpoll,int dly,struct stats *sst)
+{
+	int n=0;
+	int port;
+	int ival;
+	int fields;
+	FILE *fp;
+	struct session *s;
+	struct sockaddr_storage ss;
+	struct rlimit rl;
+	char line[256];
+	char host[128];
+
+	if(!getrlimit(RLIMIT_NOFILE,&rl)&&rl.rlim_cur<MAXSESS+64)
+	{
+		rl.rlim_cur=(rl.rlim_max<MAXSESS+64?rl.rlim_max:MAXSESS+64);
+		if(setrlimit(RLIMIT_NOFILE,&rl))
+			perror("Warning: setrlimit");
+	}
+
+	if(!(fp=fopen(file,"re")))goto err1;
+	if(!(sess=calloc(MAXSESS,sizeof(struct session))))goto err2;
+
+	while(fgets(line,sizeof(line),fp))
+	{
+		if((fields=sscanf(line,"%127s %d %d",host,&port,&ival))<1||
+			*host=='#')continue;
+		if(fields<2||port<1||port>65535||n==MAXSESS)goto err3;
+		if(fields<3)ival=dly;
+		else if(ival<0||ival>100)goto err3;
+
+		ss.ss_family=(v4?AF_INET:AF_INET6);
+		if(getaddr(host,&ss,v4)||chkaddr(&ss,dev?1:0))goto err3;
+		if(ss.ss_family==AF_INET)((struct sockaddr_in *)&ss)->
+			sin_port=htobe16(port);
+		else ((struct sockaddr_in6 *)&ss)->sin6_port=htobe16(port);
+
+		s=&sess[n];
+		if((s->fd=mksock(ss.ss_family,udp-1,0,dev,dscp,prio,cpu,
+			bpoll))==-1)goto err4;
+		if(connect(s->fd,(struct sockaddr *)&ss,
+			sizeof(struct sockaddr_storage)))goto err5;
+		s->period=ival*1000000ULL;
+		s->st=&sst[n];
+		statinit(s->st);
+		snprintf(s->name,sizeof(s->name),ss.ss_family==AF_INET?
+			"%s:%d":"[%s]:%d",host,port);
+		nsess=++n;
+	}
+	if(!n)goto err3;
+
+	fclose(fp);
+	return n;
+
+err5:	close(sess[n].fd);
+err4:	if(errno==EMFILE)fprintf(stderr,"Cannot open session %d of %s, "
+		"open file limit reached\n",n+1,file);
+	else perror("socket");
+	goto err6;
+err3:	fprintf(stderr,"Cannot use session %d of %s\n",n+1,file);
+err6:	while(n--)close(sess[n].fd);
+	free(sess);
+	sess=NULL;
+	nsess=0;
+	fclose(fp);
+	return -1;
+
+err2:	fclose(fp);
+err1:	fprintf(stderr,"Cannot read %s\n",file);
+	return -1;
+}
+
+/* the sessions are kept in a binary heap ordered by their next send
+   time, a single timerfd fires for the earliest one */
+static void sessfix(struct session **h,int n,int i)
+{
+	int c;
+	struct session *t;
+
+	while(i&&h[i]->next<h[(i-1)/2]->next)
+	{
+		t=h[i];
+		h[i]=h[(i-1)/2];
+		h[(i-1)/2]=t;
+		h[i]->hidx=i;
+		i=(i-1)/2;
+		h[i]->hidx=i;
+	}
+	while((c=2*i+1)<n)
+	{
+		if(c+1<n&&h[c+1]->next<h[c]->next)c++;
+		if(h[i]->next<=h[c]->next)break;
+		t=h[i];
+		h[i]=h[c];
+		h[c]=t;
+		h[i]->hidx=i;
+		h[c]->hidx=c;
+		i=c;
+	}
+}
+
+static void sessprint(struct session *s,int n)
+{
+	int i;
+
+	for(i=0;i<n;i++)
+	{
+		if(!s[i].st->n)printf("%s: no samples, lost %llu\n",s[i].name,
+			(unsigned long long)s[i].st->lost);
+		else printf("%s: %llu/%llu/%llu/%llu lost %llu\n",s[i].name,
+			(unsigned long long)s[i].st->min,
+			(unsigned long long)(s[i].st->sum/s[i].st->n),
+			(unsigned long long)statpct(s[i].st,99.0),
+			(unsigned long long)s[i].st->max,
+			(unsigned long long)s[i].st->lost);
+	}
+	fflush(stdout);
+}
+
+/* all sessions share one thread, a session has at most one probe in
+   flight, it is lost if the next one is due before the reply arrived
+   or after a second with an interval of 0 */
+static int sessinitiator(struct session *s,int n,int bpoll,int ts,int cont,
+	struct stats *all)
+{
+	int i;
+	int l;
+	int ep;
+	int tfd;
+	int res=-1;
+	int chg=0;
+	uint64_t now;
+	uint64_t cnt=0;
+	uint64_t rnext;
+	struct session *c;
+	struct session **h;
+	struct itimerspec it;
+	struct timespec tm;
+	struct epoll_event ev[64];
+	struct probe *data;
+	unsigned char bfr[DATASIZE];
+
+	if(!(h=malloc(n*sizeof(struct session *))))goto err1;
+	if((ep=epopen(bpoll))==-1)goto err2;
+	if((tfd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK|TFD_CLOEXEC))==-1)
+	{
+		perror("timerfd_create");
+		goto err3;
+	}
+	if(epadd(ep,tfd,NULL,0))goto err4;
+
+	clock_gettime(CLOCK_MONOTONIC,&tm);
+	now=tsns(&tm);
+	rnext=now+1000000000ULL;
+
+	/* spread the first probes over the interval */
+	for(i=0;i<n;i++)
+	{
+		if(epadd(ep,s[i].fd,&s[i],bpoll))goto err4;
+		s[i].next=now+s[i].period*i/n;
+		h[i]=&s[i];
+		h[i]->hidx=i;
+		sessfix(h,i+1,i);
+	}
+
+	memset(bfr,0,sizeof(bfr));
+	data=(struct probe *)bfr;
+	memset(&it,0,sizeof(it));
+
+	while(!stop)
+	{
+		it.it_value.tv_sec=h[0]->next/1000000000;
+		it.it_value.tv_nsec=h[0]->next%1000000000;
+		if(!it.it_value.tv_sec&&!it.it_value.tv_nsec)
+			it.it_value.tv_nsec=1;
+		timerfd_settime(tfd,TFD_TIMER_ABSTIME,&it,NULL);
+
+		l=epoll_wait(ep,ev,64,rnext>now?(rnext-now)/1000000+1:0);
+		if(dump)
+		{
+			dump=0;
+			sessprint(s,n);
+		}
+
+		for(i=0;i<l;i++)
+		{
+			/* rearming the timer clears its expirations */
+			if(!(c=ev[i].data.ptr))continue;
+			while(recv(c->fd,bfr,sizeof(bfr),MSG_DONTWAIT)==
+				sizeof(bfr))
+			{
+				if(!c->sent||data->seq!=c->seq-1)continue;
+				clock_gettime(CLOCK_MONOTONIC,&tm);
+				now=tsns(&tm);
+				if(now<c->sent)continue;
+				/* the first probes warm up the path */
+				if(data->seq>=20)
+				{
+					statadd(c->st,now-c->sent);
+					chg|=statadd(all,now-c->sent);
+					if(++cnt==limit)stop=1;
+				}
+				c->sent=0;
+				if(!c->period)
+				{
+					c->next=now;
+					sessfix(h,n,c->hidx);
 				}
-				break;
 			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC,&tm);
+		now=tsns(&tm);
+
+		while(h[0]->next<=now&&!stop)
+		{
+			c=h[0];
+			if(c->sent&&c->seq>20)
+			{
+				c->st->lost++;
+				all->lost++;
+			}
+			data->seq=c->seq++;
+			clock_gettime(CLOCK_MONOTONIC,&data->ts);
+			c->sent=tsns(&data->ts);
+			if(send(c->fd,bfr,sizeof(bfr),MSG_DONTWAIT)!=sizeof(bfr))
+			{
+				perror("Warning: send");
+				c->sent=0;
+				if(c->seq>20)
+				{
+					c->st->lost++;
+					all->lost++;
+				}
+			}
+			if(!c->period)c->next=now+1000000000ULL;
+			else if((c->next+=c->period)<=now)c->next=now+c->period;
+			sessfix(h,n,0);
+		}
+
+		if(now>=rnext)
+		{
+			if(all->n)statreport(all,0,ts,cont,chg);
+			chg=0;
+			while(rnext<=now)rnext+=1000000000ULL;
+		}
+	}
+	res=0;
+
+err4:	close(tfd);
+err3:	close(ep);
+err2:	free(h);
+err1:	if(res)fprintf(stderr,"Cannot start sessions\n");
+	return res;
+}
+
+static int readint(char *file,int *val)
+{
+	FILE *fp;
+	int res=-1;
+
+	if(!(fp=fopen(file,"re")))return -1;
+	if(fscanf(fp,"%d",val)==1)res=0;
+	fclose(fp);
+	return res;
+}
+
+static int readcpus(char *file,cpu_set_t *set)
+{
+	int a;
+	int b;
+	int c;
+	FILE *fp;
+
+	CPU_ZERO(set);
+	if(!(fp=fopen(file,"re")))return -1;
+	while(fscanf(fp,"%d",&a)==1)
+	{
+		b=a;
+		if((c=fgetc(fp))=='-')
+		{
+			if(fscanf(fp,"%d",&b)!=1)break;
+			c=fgetc(fp);
+		}
+		for(;a<=b&&a<CPU_SETSIZE;a++)CPU_SET(a,set);
+		if(c!=',')break;
+	}
+	fclose(fp);
+	return 0;
+}
+
+/* virtual functions and virtio devices keep numa_node and msi_irqs
+   with the parent device */
+static int nicnode(char *dev)
+{
+	int node;
+	char bfr[PATH_MAX];
+
+	snprintf(bfr,sizeof(bfr),"/sys/class/net/%s/device/numa_node",dev);
+	if(!readint(bfr,&node))return node;
+	snprintf(bfr,sizeof(bfr),"/sys/class/net/%s/device/../numa_node",
+		dev);
+	if(!readint(bfr,&node))return node;
+	return -1;
+}
+
+static int nicirq(char *dev,int irq)
+{
+	int res=0;
+	DIR *d;
+	struct dirent *e;
+	char bfr[PATH_MAX];
+
+	snprintf(bfr,sizeof(bfr),"/sys/class/net/%s/device/msi_irqs/%d",dev,
+		irq);
+	if(!access(bfr,F_OK))return 1;
+	snprintf(bfr,sizeof(bfr),"/sys/class/net/%s/device/../msi_irqs/%d",
+		dev,irq);
+	if(!access(bfr,F_OK))return 1;
+
+	snprintf(bfr,sizeof(bfr),"/proc/irq/%d",irq);
+	if(!(d=opendir(bfr)))return 0;
+	while((e=readdir(d)))if(!strncmp(e->d_name,dev,strlen(dev))&&
+		!isalnum(e->d_name[strlen(dev)]))
+	{
+		res=1;
+		break;
+	}
+	closedir(d);
+	return res;
+}
+
+static int nicirqs(char *dev,cpu_set_t *set)
+{
+	int n=0;
+	int irq;
+	DIR *d;
+	struct dirent *e;
+	cpu_set_t aff;
+	char bfr[PATH_MAX];
+
+	CPU_ZERO(set);
+	if(!(d=opendir("/proc/irq")))return 0;
+	while((e=readdir(d)))
+	{
+		if(*e->d_name<'0'||*e->d_name>'9')continue;
+		irq=atoi(e->d_name);
+		if(!nicirq(dev,irq))continue;
+		snprintf(bfr,sizeof(bfr),"/proc/irq/%d/smp_affinity_list",irq);
+		if(readcpus(bfr,&aff))continue;
+		CPU_OR(set,set,&aff);
+		n++;
+	}
+	closedir(d);
+	return n;
+}
+
+static int routedev(struct sockaddr_storage *dest,char *dev)
+{
+	int s;
+	int res=-1;
+	socklen_t sl=sizeof(struct sockaddr_storage);
+	struct sockaddr_storage tmp=*dest;
+	struct sockaddr_storage local;
+	struct ifaddrs *ifa;
+	struct ifaddrs *e;
+
+	if(tmp.ss_family==AF_INET)((struct sockaddr_in *)&tmp)->sin_port=
+		htobe16(LOADPORT);
+	else ((struct sockaddr_in6 *)&tmp)->sin6_port=htobe16(LOADPORT);
+
+	if((s=socket(tmp.ss_family,SOCK_DGRAM|SOCK_CLOEXEC,0))==-1)
+		return -1;
+	if(connect(s,(struct sockaddr *)&tmp,sizeof(tmp))||
+		getsockname(s,(struct sockaddr *)&local,&sl))goto err1;
+	if(getifaddrs(&ifa))goto err1;
+	for(e=ifa;e;e=e->ifa_next)if(e->ifa_addr&&
+		!addrcmp(&local,(struct sockaddr_storage *)e->ifa_addr))
+	{
+		strncpy(dev,e->ifa_name,IFNAMSIZ-1);
+		dev[IFNAMSIZ-1]=0;
+		res=0;
+		break;
+	}
+	freeifaddrs(ifa);
+err1:	close(s);
+	return res;
+}
+
+/* with auto placement pick the measurement and load cores from the
+   NIC's node avoiding the cores serving its interrupts and prefer node
+   local memory, in any case warn about what looks wrong */
+static int placement(char *dev,int autop,int *cpu,int *lcpu,int rcpu,
+	int load)
+{
+	int i;
+	int node;
+	int nirq;
+	unsigned long mask[CPU_SETSIZE/(8*sizeof(unsigned long))];
+	cpu_set_t all;
+	cpu_set_t local;
+	cpu_set_t irq;
+	char bfr[PATH_MAX];
+
+	if(sched_getaffinity(0,sizeof(cpu_set_t),&all))return -1;
+
+	node=nicnode(dev);
+	local=all;
+	if(node>=0)
+	{
+		snprintf(bfr,sizeof(bfr),"/sys/devices/system/node/node%d/"
+			"cpulist",node);
+		if(!readcpus(bfr,&local))CPU_AND(&local,&local,&all);
+		if(!CPU_COUNT(&local))
+		{
+			fprintf(stderr,"Warning: no usable core on node %d of "
+				"%s\n",node,dev);
+			local=all;
+		}
+	}
+	nirq=nicirqs(dev,&irq);
+
+	if(autop)
+	{
+		for(i=0;i<CPU_SETSIZE;i++)if(CPU_ISSET(i,&local)&&
+			!CPU_ISSET(i,&irq)&&i!=rcpu)
+		{
+			if(*cpu==-1)*cpu=i;
+			else if(load&&*lcpu==-1&&i!=*cpu)*lcpu=i;
+		}
+		for(i=0;*cpu==-1&&i<CPU_SETSIZE;i++)if(CPU_ISSET(i,&local))
+			*cpu=i;
+
+		if(node>=0)
+		{
+			memset(mask,0,sizeof(mask));
+			mask[node/(8*sizeof(unsigned long))]|=
+				1UL<<(node%(8*sizeof(unsigned long)));
+			if(syscall(SYS_set_mempolicy,MPOL_PREFERRED,mask,
+				sizeof(mask)*8))
+				perror("Warning: set_mempolicy");
+		}
+
+		fprintf(stderr,"placement: %s node %d, %d interrupts, core %d",
+			dev,node,nirq,*cpu);
+		if(*lcpu!=-1)fprintf(stderr,", load core %d",*lcpu);
+		fprintf(stderr,"\n");
+	}
+
+	if(*cpu!=-1)
+	{
+		if(!CPU_ISSET(*cpu,&local))fprintf(stderr,"Warning: core %d "
+			"is not on node %d of %s\n",*cpu,node,dev);
+		if(CPU_ISSET(*cpu,&irq))fprintf(stderr,"Warning: core %d "
+			"serves interrupts of %s\n",*cpu,dev);
+		if(*cpu==*lcpu&&load)fprintf(stderr,"Warning: load generator "
+			"shares core %d with the measurement\n",*cpu);
+		if(*cpu==rcpu)fprintf(stderr,"Warning: reporter shares core "
+			"%d with the measurement\n",*cpu);
+	}
+	return 0;
+}
+
+static void sigstop(int sig)
+{
+	stop=1;
+}
+
+static void sigdump(int sig)
+{
+	dump=1;
+}
+
+static int getslo(char *arg,struct slo *slo)
+{
+	char *end;
+
+	slo->pct=strtod(arg,&end);
+	if(end==arg||*end!=':'||slo->pct<=0.0||slo->pct>100.0)return -1;
+	arg=end+1;
+	if(*arg<'0'||*arg>'9')return -1;
+	slo->val=strtoull(arg,&end,10);
+	if(*end||!slo->val)return -1;
+	return 0;
+}
+
+/* comma separated list of rx=<frames>,tx=<frames>,block=<bytes>,
+   rxbuf=<bytes> and txbuf=<bytes> */
+static int getgeom(char *arg,struct geom *rx,struct geom *tx)
+{
+	int i;
+	int l;
+	long v;
+	char *end;
+	long pg=sysconf(_SC_PAGESIZE);
+	static char *key[]={"rx=","tx=","block=","rxbuf=","txbuf=",NULL};
+
+	while(1)
+	{
+		for(i=0;key[i];i++)if(!strncmp(arg,key[i],l=strlen(key[i])))
+			break;
+		if(!key[i])return -1;
+		arg+=l;
+		if(*arg<'0'||*arg>'9')return -1;
+		v=strtol(arg,&end,10);
+		arg=end;
+		switch(i)
+		{
+		case 0:	if(v<1||v>65536)return -1;
+			rx->frames=v;
+			break;
+		case 1:	if(v<1||v>65536)return -1;
+			tx->frames=v;
+			break;
+		case 2:	if(v<pg||v>4194304||v%pg)return -1;
+			rx->block=tx->block=v;
+			break;
+		case 3:	if(v<4096||v>1073741824)return -1;
+			rx->buf=v;
+			break;
+		case 4:	if(v<4096||v>1073741824)return -1;
+			tx->buf=v;
+			break;
+		}
+		if(!*arg)return 0;
+		if(*arg++!=',')return -1;
+	}
+}
+
+static char *stname(char *bfr,int i,int ncls,int nresp,int nq)
+{
+	if(nsess)sprintf(bfr,"session %d",i+1);
+	else if(ncls)sprintf(bfr,"class %s",label[i]);
+	else if(nq)sprintf(bfr,"queue %s",label[i]);
+	else if(!nresp)strcpy(bfr,"all");
+	else if(!i)strcpy(bfr,"last");
+	else sprintf(bfr,"responder %s",label[i]);
+	return bfr;
+}
+
+static int slocheck(struct stats *s,char *name,uint64_t bound,
+	struct slo *slo,int nslo)
+{
+	int i;
+	int res=0;
+	uint64_t val;
+	char id[32];
+
+	if(!name)*id=0;
+	else sprintf(id,"%s ",name);
+
+	if(!s->n)
+	{
+		fprintf(stderr,"%s%sno samples\n",bound||nslo?"SLO violated: ":
+			"Failed: ",id);
+		return -1;
+	}
+	if(bound&&s->max>bound)
+	{
+		fprintf(stderr,"SLO violated: %smaximum %llu > %llu\n",id,
+			(unsigned long long)s->max,(unsigned long long)bound);
+		res=-1;
+	}
+	for(i=0;i<nslo;i++)if((val=statpct(s,slo[i].pct))>slo[i].val)
+	{
+		fprintf(stderr,"SLO violated: %s%g%% %llu > %llu\n",id,
+			slo[i].pct,(unsigned long long)val,
+			(unsigned long long)slo[i].val);
+		res=-1;
+	}
+	return res;
+}
+
+static void jsonstats(struct stats *s)
+{
+	int i;
+	static double pct[]={50.0,90.0,99.0,99.9,99.99,0.0};
+
+	printf("\"samples\":%llu,\"lost\":%llu",(unsigned long long)s->n,
+		(unsigned long long)s->lost);
+	if(!s->n)return;
+	printf(",\"min\":%llu,\"avg\":%llu,\"max\":%llu,\"percentiles\":{",
+		(unsigned long long)s->min,(unsigned long long)(s->sum/s->n),
+		(unsigned long long)s->max);
+	for(i=0;pct[i]!=0.0;i++)printf("%s\"%g\":%llu",i?",":"",pct[i],
+		(unsigned long long)statpct(s,pct[i]));
+	printf("}");
+}
+
+static void txprint(struct txstamp *t)
+{
+	int i;
+	struct stats *s;
+
+	for(i=0;i<3;i++)
+	{
+		s=&t->st[i];
+		if(!s->n)printf("transmit %s: no stamps\n",txname[i]);
+		else printf("transmit %s: %llu/%llu/%llu/%llu ns, %llu samples\n",
+			txname[i],(unsigned long long)s->min,
+			(unsigned long long)(s->sum/s->n),
+			(unsigned long long)statpct(s,99.0),
+			(unsigned long long)s->max,(unsigned long long)s->n);
+	}
+}
+
+static void jsonsum(char *mode,char *dev,char *host,char *group,int port,
+	int dly,int prio,int dscp,int *cls,int ncls,int nresp,
+	struct sockaddr_storage *resp,int nq,struct stats *st,uint64_t bound,
+	struct slo *slo,int nslo,int *res,int err)
+{
+	int i;
+	int pass=1;
+	char addr[INET6_ADDRSTRLEN];
+
+	printf("{\"mode\":\"%s\"",mode);
+	if(dev)printf(",\"device\":\"%s\"",dev);
+	if(host)printf(",\"host\":\"%s\"",host);
+	if(group)printf(",\"group\":\"%s\"",group);
+	if(port)printf(",\"port\":%d",port);
+	printf(",\"interval_us\":%d",dly);
+	if(prio)printf(",\"priority\":%d",prio);
+	if(dscp)printf(",\"dscp\":%d",dscp);
+	if(limit)printf(",\"limit\":%llu",(unsigned long long)limit);
+	if(bound)printf(",\"bound_ns\":%llu",(unsigned long long)bound);
+	if(nslo)
+	{
+		printf(",\"slo\":[");
+		for(i=0;i<nslo;i++)printf("%s{\"percentile\":%g,\"limit_ns\":"
+			"%llu}",i?",":"",slo[i].pct,
+			(unsigned long long)slo[i].val);
+		printf("]");
+	}
+	if(ncls)
+	{
+		printf(",\"classes\":[");
+		for(i=0;i<ncls;i++)
+		{
+			if(res[i])pass=0;
+			printf("%s{\"class\":%d,",i?",":"",cls[i]);
+			jsonstats(&st[i]);
+			printf(",\"passed\":%s}",res[i]?"false":"true");
+		}
+		printf("]");
+	}
+	else if(nresp)
+	{
+		printf(",\"responders\":[");
+		for(i=0;i<=nresp;i++)
+		{
+			if(res[i])pass=0;
+			if(!i)printf("{\"responder\":\"last\",");
+			else if(resp[i-1].ss_family)printf(",{\"responder\":"
+				"\"%s\",",addrstr(&resp[i-1],addr));
+			else printf(",{\"responder\":null,");
+			jsonstats(&st[i]);
+			printf(",\"passed\":%s}",res[i]?"false":"true");
+		}
+		printf("]");
+	}
+	else if(nsess)
+	{
+		printf(",\"sessions\":[");
+		for(i=0;i<nsess;i++)
+		{
+			if(res[i])pass=0;
+			printf("%s{\"session\":\"%s\",",i?",":"",sess[i].name);
+			jsonstats(&st[i]);
+			printf(",\"passed\":%s}",res[i]?"false":"true");
+		}
+		printf("]");
+	}
+	else if(nq)
+	{
+		printf(",\"queues\":[");
+		for(i=0;i<nq;i++)
+		{
+			if(res[i])pass=0;
+			printf("%s{\"queue\":\"%s\",",i?",":"",label[i]);
+			jsonstats(&st[i]);
+			printf(",\"passed\":%s}",res[i]?"false":"true");
+		}
+		printf("]");
+	}
+	else
+	{
+		if(*res)pass=0;
+		printf(",");
+		jsonstats(st);
+	}
+	if(tstx)
+	{
+		printf(",\"txpath\":[");
+		for(i=0;i<3;i++)
+		{
+			printf("%s{\"stage\":\"%s\",",i?",":"",txname[i]);
+			jsonstats(&tstx->st[i]);
+			printf("}");
+		}
+		printf("]");
+	}
+	printf(",\"aborted\":%s,\"passed\":%s}\n",err?"true":"false",
+		pass&&!err?"true":"false");
+}
+
+static void usage(void)
+{
+	fprintf(stderr,"Usage:\n\n"
+	"netdelay [<options>] -R -i <netdevice>\n"
+	"netdelay [<options>] -I -i <netdevice> -d <destination-mac>\n"
+	"netdelay [<options>] -R -u|-U|-T -P <port>\n"
+	"netdelay [<options>] -I -u|-U|-T -h <destination-address> -P <port>"
+	"\n"
+	"netdelay [<options>] -R -u|-U -G <group> -P <port>\n"
+	"netdelay [<options>] -I -u|-U -G <group> -f <count> -P <port>\n"
+	"netdelay [<options>] -B clock|shm|unix\n"
+	"netdelay merge <output-file> <input-file> ...\n"
+	"netdelay compare <base-file> <new-file>\n"
+	"netdelay bench [<probes> [<geometry> ...]]\n\n"
+	"-I initiator mode\n"
+	"-R responder mode\n"
+	"-B <mode> measure host only baseline: clock_gettime overhead,\n"
+	"   shared memory or unix datagram ping-pong between two processes\n"
+	"-u use UDP instead of layer 2\n"
+	"-U use UDPLITE instead of layer 2\n"
+	"-T use TCP instead of layer 2\n"
+	"-Q set TCP_QUICKACK after every receive for TCP\n"
+	"-4 force IPv4 for UDP/UDPLITE/TCP\n"
+	"-w <time> time to wait between tests in ms (0-100, default 50)\n"
+	"-b <value> set busy poll (1-500)\n"
+	"-i <netdevice> network device to use\n"
+	"-d <destination-mac> ethernet address of responder\n"
+	"-h <destination-host> UDP/UDPLITE/TCP destination host\n"
+	"-P <port> UDP/UDPLITE/TCP local and remote port (1-65535)\n"
+	"-G <group> multicast group, responders join the group and reply\n"
+	"   unicast to the initiator\n"
+	"-f <count> number of responders to expect in the group (1-32)\n"
+	"-e <time> schedule UDP/UDPLITE probes with SO_TXTIME on CLOCK_TAI\n"
+	"   this many us ahead on a grid of the probe interval, the\n"
+	"   roundtrip counts from the scheduled launch (1-100000)\n"
+	"-g with -e wait locally for the launch time instead, for devices\n"
+	"   without an etf qdisc such as veth\n"
+	"-y collect transmit timestamps of the probes and report the time\n"
+	"   spent in the qdisc, the driver and until the wire\n"
+	"-q <count> spread UDP/UDPLITE probes over count flows using local\n"
+	"   ports starting at the given port and report per receive\n"
+	"   queue and core of the replies (1-256)\n"
+	"-D <value> set DSCP value for UDP/UDPLITE/TCP (1-63)\n"
+	"-r <value> set realtime priority (1-99)\n"
+	"-c <value> set core to run on (0-1023)\n"
+	"-a choose the core to run on and the load core from the NUMA node\n"
+	"   of the network device avoiding cores serving its interrupts\n"
+	"   and prefer memory of that node\n"
+	"-v <value> set 802.1q vlan (1-4094)\n"
+	"-p <value> set 802.1p priority (1-7)\n"
+	"-M <list> probe several classes concurrently, comma separated list\n"
+	"   of 802.1p priorities (0-7) or DSCP values (0-63) for UDP/UDPLITE\n"
+	"-l <value> set system latency via /dev/cpu_dma_latency (0-9999)\n"
+	"-L <rate> generate background load in packets per second,\n"
+	"   0 for line rate (0-10000000)\n"
+	"-S <size> load packet size in bytes (64-1472, default 1472)\n"
+	"-k <value> set core for load generation or baseline peer (0-1023)\n"
+	"-x <file> write request and reply of slow probes to a pcapng file\n"
+	"-X <time> capture probes with at least this roundtrip in ns,\n"
+	"   default is probes reaching the maximum roundtrip\n"
+	"-n <count> stop after count samples (rounds with -M)\n"
+	"-N <time> stop after time seconds\n"
+	"-j print a JSON summary at the end of the run\n"
+	"-o <file> write the histograms to file at the end of the run\n"
+	"-O <value> aggregate and print samples in a reporter thread on\n"
+	"   this core instead of the measurement thread (0-1023),\n"
+	"   cannot be combined with -x\n"
+	"-H back the -O sample ring with huge pages if available\n"
+	"-A <time> fail if any roundtrip exceeds time in ns\n"
+	"-s <percentile>:<time> fail if the percentile exceeds time in ns,\n"
+	"   may be given up to 8 times, e.g. -s 99.9:50000\n"
+	"-Y <file> replay the packet sizes and inter-arrival times of a\n"
+	"   pcap file as probes without waiting for replies, -w is the\n"
+	"   pause between passes of the trace\n"
+	"-Z <file> run the UDP/UDPLITE sessions listed in file from one\n"
+	"   thread, one line per session: <host> <port> [<interval ms>]\n"
+	"-z <count> serve count consecutive ports starting at the given\n"
+	"   port from one responder thread (1-256)\n"
+	"-K <list> layer 2 ring geometry, comma separated rx=<frames>\n"
+	"   (default 64), tx=<frames> (default 4096), block=<bytes> (page\n"
+	"   multiple, default one page), rxbuf=<bytes> and txbuf=<bytes>\n"
+	"   (default 2097152), the resulting geometry is printed\n"
+	"-E <time> collect responder statistics and print them every time\n"
+	"   seconds, on SIGUSR1 and at the end, 0 for SIGUSR1 only (0-3600)\n\n"
+	"-F don't sleep on ENOBUFS in layer2 mode, retry instantly\n"
+	"-m lock process memory\n"
+	"-t print timestamp\n"
+	"-C new line only if minimum or maximum value has changed\n"
+	"If UDP/UDPLITE/TCP is used specifying a network device disables IPv4\n"
+	"routing and requires an IPv6 link local address.\n\n"
+	"This tool measures network roundtrip delay with layer 2 packets\n"
+	"bypassing the kernel network stack.\n\n"
+	"The output is 3 columns, all in nanoseconds:\n\n"
+	"minimum-delay average-delay maximum-delay\n\n"
+	"With -M each class is shown as class:min/average/99%%/max.\n"
+	"With -G the round trip of the last responder of each round is\n"
+	"shown first as last:min/average/99%%/max, followed by each\n"
+	"responder in the order they were first seen.\n"
+	"With -q each receive queue is shown as c<core>/n<napi id> or as\n"
+	"c<core> if the kernel does not provide the napi id.\n"
+	"With -L the achieved load rate is appended.\n"
+	"With -E the responder prints the reflected packets, transmit ring\n"
+	"full events, ENOBUFS retries, send errors, poll wakeups and the\n"
+	"average/maximum batch per wakeup, the turnaround from the kernel\n"
+	"receive stamp until the reply is sent as min/average/99%%/max and\n"
+	"the packets per source. Rates are per reporting interval.\n"
+	"With -Z the running line covers all sessions, the sessions are\n"
+	"printed as host:port: min/average/99%%/max and lost probes on\n"
+	"SIGUSR1 and at the end. With -b epoll busy polling is used if\n"
+	"the kernel supports it.\n"
+	"With -y the transmit path is summarized at the end as stage:\n"
+	"min/average/99%%/max. Layer 2 probes only get the completion stamp\n"
+	"measured from the send call. Hardware stamps need timestamping\n"
+	"enabled on the device and its clock synchronized to CLOCK_REALTIME.\n\n"
+	"SIGINT and SIGTERM end a run gracefully. The exit code is 0 on\n"
+	"success, 1 on errors and 2 if a latency bound or SLO is violated\n"
+	"or no samples were collected.\n\n"
+	"Load frames use ethertype 0x88b6 with 802.1p priority 0, UDP load\n"
+	"is sent to the discard port of the responder host.\n\n"
+	"Histogram files of several runs or hosts are combined per class\n"
+	"with merge. compare prints percentile deltas and a Kolmogorov-\n"
+	"Smirnov test per class and exits with 2 if the new file shows a\n"
+	"significant upwards shift (p<0.01).\n\n"
+	"bench runs the UDP and layer 2 probe loop variants locally over\n"
+	"a unix datagram socket pair and the loopback device and prints\n"
+	"the cpu time per probe, the average and the 99%% roundtrip of\n"
+	"each variant (1000-10000000 probes, default 100000). Each given\n"
+	"geometry is a -K list, the layer 2 variants without vlan are run\n"
+	"again with the rings of that geometry to compare them.\n");
+	exit(1);
+}
+
+static void put32(unsigned char **p,uint32_t val)
+{
+	val=htole32(val);
+	memcpy(*p,&val,4);
+	*p+=4;
+}
+
+static void put64(unsigned char **p,uint64_t val)
+{
+	val=htole64(val);
+	memcpy(*p,&val,8);
+	*p+=8;
+}
+
+static uint32_t get32(unsigned char **p)
+{
+	uint32_t val;
 
-			txhdr=(struct tpacket2_hdr *)tx->data[curr];
-			switch(txhdr->tp_status)
-			{
-			case TP_STATUS_WRONG_FORMAT:
-				txhdr->tp_status=TP_STATUS_AVAILABLE;
-			case TP_STATUS_AVAILABLE:
-				break;
-			default:fprintf(stderr, "Warning: tx queue full\n");
-				goto skip;
-			}
+	memcpy(&val,*p,4);
+	*p+=4;
+	return le32toh(val);
+}
 
-			rxe=(struct ethhdr *)(rx->data[rx->index]+rx->hoff);
-			txe=(struct ethhdr *)(tx->data[curr]+tx->hoff);
+static uint64_t get64(unsigned char **p)
+{
+	uint64_t val;
 
-			memcpy(txe->h_source,rxe->h_dest,ETH_ALEN);
-			memcpy(txe->h_dest,rxe->h_source,ETH_ALEN);
+	memcpy(&val,*p,8);
+	*p+=8;
+	return le64toh(val);
+}
 
-			if(prio)
-			{
-				txe->h_proto=htobe16(ETH_P_8021Q);
-				vdata[1]=rxe->h_proto;
-				memcpy(tx->data[curr]+tx->doff,vdata,4);
-				memcpy(tx->data[curr]+tx->doff+4,data,16);
-			}
-			else
-			{
-				txe->h_proto=rxe->h_proto;
-				memcpy(tx->data[curr]+tx->doff,data,16);
-			}
-			txhdr->tp_len=DATASIZE;
-			txhdr->tp_status=TP_STATUS_SEND_REQUEST;
+static int histwrite(char *file,struct hrec *r,int n)
+{
+	int i;
+	int j;
+	int nz;
+	int res=-1;
+	FILE *fp;
+	unsigned char *bfr;
+	unsigned char *p;
 
-			rep=50;
-again:			if(send(tx->fd,NULL,0,MSG_DONTWAIT)<0)
-			{
-				if(errno==ENOBUFS)if(rep--)
-				{
-					if(!fast)usleep(2);
-					goto again;
-				}
-				perror("Warning: send");
-			}
+	if(!(bfr=malloc(24+n*(HRECHDR+HISTSIZE*12))))goto err1;
 
-			tx->head=next;
+	p=bfr;
+	memcpy(p,HISTMAGIC,8);
+	p+=8;
+	put32(&p,HISTBITS);
+	put32(&p,HISTMAX);
+	put32(&p,n);
+	put32(&p,0);
 
-skip:			rxhdr->tp_status=TP_STATUS_KERNEL;
-			if((rx->index+=1)==rx->total)rx->index=0;
+	for(i=0;i<n;i++)
+	{
+		memcpy(p,r[i].name,sizeof(r[i].name));
+		p+=sizeof(r[i].name);
+		memcpy(p,r[i].info,sizeof(r[i].info));
+		p+=sizeof(r[i].info);
+		put64(&p,r[i].st.n);
+		put64(&p,r[i].st.lost);
+		put64(&p,r[i].st.min);
+		put64(&p,r[i].st.max);
+		put64(&p,r[i].st.sum);
+		for(nz=0,j=0;j<HISTSIZE;j++)if(r[i].st.hist[j])nz++;
+		put32(&p,nz);
+		for(j=0;j<HISTSIZE;j++)if(r[i].st.hist[j])
+		{
+			put32(&p,j);
+			put64(&p,r[i].st.hist[j]);
 		}
 	}
+
+	if(!(fp=fopen(file,"we")))goto err2;
+	if(fwrite(bfr,p-bfr,1,fp)==1)res=0;
+	if(fclose(fp))res=-1;
+
+err2:	free(bfr);
+err1:	if(res)fprintf(stderr,"Cannot write %s\n",file);
+	return res;
 }
 
-static void udpinitiator(int us,int port,struct sockaddr_storage *ss,int ts,
-	int dly,int cont)
+static struct hrec *histread(char *file,int *n)
 {
-	int l;
-	struct sockaddr_in *s4=(struct sockaddr_in *)ss;
-	struct sockaddr_in6 *s6=(struct sockaddr_in6 *)ss;
-	struct timespec *data;
-	int pre=20;
-	int chg=0;
-	uint64_t val;
-	uint64_t min=-1;
-	uint64_t max=0;
-	uint64_t sum=0;
-	uint64_t n=0;
-	uint64_t mask=dly?0xf:0x7ff;
-	struct pollfd p;
-	struct timespec tm;
-	unsigned char bfr[DATASIZE];
-	struct tm stm;
-	char datim[64];
+	int i;
+	uint32_t j;
+	uint32_t nz;
+	uint32_t idx;
+	long len;
+	FILE *fp;
+	struct hrec *r=NULL;
+	unsigned char *bfr;
+	unsigned char *p;
+	unsigned char *end;
 
-	if(ss->ss_family==AF_INET)s4->sin_port=htobe16(port);
-	else s6->sin6_port=htobe16(port);
+	if(!(fp=fopen(file,"re")))goto err1;
+	if(fseek(fp,0,SEEK_END)||(len=ftell(fp))<24||fseek(fp,0,SEEK_SET))
+		goto err2;
+	if(!(bfr=malloc(len)))goto err2;
+	if(fread(bfr,len,1,fp)!=1)goto err3;
 
-	p.fd=us;
-	p.events=POLLIN|POLLHUP|POLLERR;
+	p=bfr;
+	end=bfr+len;
+	if(memcmp(p,HISTMAGIC,8))goto err3;
+	p+=8;
+	if(get32(&p)!=HISTBITS||get32(&p)!=HISTMAX)goto err3;
+	if((*n=get32(&p))<1||*n>1024)goto err3;
+	p+=4;
 
-	data=(struct timespec *)bfr;
+	if(!(r=malloc(*n*sizeof(struct hrec))))goto err3;
 
-	while(1)
+	for(i=0;i<*n;i++)
 	{
-		clock_gettime(CLOCK_MONOTONIC,data);
-		if((l=sendto(us,bfr,sizeof(bfr),MSG_DONTWAIT,
-			(struct sockaddr *)ss,
-			sizeof(struct sockaddr_storage)))!=sizeof(bfr))
+		if(end-p<HRECHDR)goto err4;
+		statinit(&r[i].st);
+		memcpy(r[i].name,p,sizeof(r[i].name));
+		p+=sizeof(r[i].name);
+		r[i].name[sizeof(r[i].name)-1]=0;
+		memcpy(r[i].info,p,sizeof(r[i].info));
+		p+=sizeof(r[i].info);
+		r[i].info[sizeof(r[i].info)-1]=0;
+		r[i].st.n=get64(&p);
+		r[i].st.lost=get64(&p);
+		r[i].st.min=get64(&p);
+		r[i].st.max=get64(&p);
+		r[i].st.sum=get64(&p);
+		if((nz=get32(&p))>HISTSIZE||(size_t)(end-p)<(size_t)nz*12)
+			goto err4;
+		for(j=0;j<nz;j++)
 		{
-			if(l<0)perror("Warning: sendto");
-			else fprintf(stderr,"Warning: sendto unspecified "
-				"error");
-			goto skip;
+			if((idx=get32(&p))>=HISTSIZE)goto err4;
+			r[i].st.hist[idx]=get64(&p);
 		}
+	}
 
-		if(poll(&p,1,1000)<1)
-		{
-			fprintf(stderr,"Warning: poll timed out\n");
-			goto skip;
-		}
+	free(bfr);
+	fclose(fp);
+	return r;
 
-		clock_gettime(CLOCK_MONOTONIC,&tm);
+err4:	free(r);
+	r=NULL;
+err3:	free(bfr);
+err2:	fclose(fp);
+err1:	fprintf(stderr,"Cannot read %s\n",file);
+	return r;
+}
 
-		if(!(p.revents&POLLIN))
-		{
-			fprintf(stderr,"Warning: no data after poll\n");
-			goto skip;
-		}
+static void histsum(struct stats *d,struct stats *s)
+{
+	int i;
 
-		if((l=recv(us,bfr,sizeof(bfr),MSG_DONTWAIT))<=0)
-		{
-			if(l<0)perror("recv");
-			else fprintf(stderr,"unspecified receive error\n");
-			return;
-		}
+	d->n+=s->n;
+	d->lost+=s->lost;
+	d->sum+=s->sum;
+	if(s->n&&s->min<d->min)d->min=s->min;
+	if(s->max>d->max)d->max=s->max;
+	for(i=0;i<HISTSIZE;i++)d->hist[i]+=s->hist[i];
+}
 
-		if(l!=DATASIZE)
-		{
-			fprintf(stderr,"Warning: unexpected data length\n");
-			goto skip;
-		}
+static int histmerge(int argc,char *argv[])
+{
+	int i;
+	int j;
+	int k;
+	int n;
+	int total=0;
+	int res;
+	struct hrec *r;
+	struct hrec *m=NULL;
+	struct hrec *tmp;
 
-		if(tm.tv_nsec<data->tv_nsec)
-		{
-			tm.tv_nsec+=1000000000;
-			tm.tv_sec--;
-		}
-		if(tm.tv_sec<data->tv_sec)
+	if(argc<2)usage();
+
+	for(i=1;i<argc;i++)
+	{
+		if(!(r=histread(argv[i],&n)))
 		{
-			fprintf(stderr,"time mismatch, aborting\n");
-			return;
+			free(m);
+			return 1;
 		}
-		tm.tv_sec-=data->tv_sec;
-		tm.tv_nsec-=data->tv_nsec;
-
-		if(tm.tv_sec)fprintf(stderr, "Warning: wrong data skipped\n");
-		else if(pre)pre--;
-		else
+		for(j=0;j<n;j++)
 		{
-			val=tm.tv_sec;
-			val*=1000000000;
-			val+=tm.tv_nsec;
-			sum+=val;
-			n++;
-			if(val<min)
-			{
-				min=val;
-				chg=1;
-			}
-			if(val>max)
-			{
-				max=val;
-				chg=1;
-			}
-
-			if(!(n&mask))
+			for(k=0;k<total;k++)if(!strcmp(m[k].name,r[j].name))
+				break;
+			if(k==total)
 			{
-				if(ts)
+				if(!(tmp=realloc(m,(total+1)*
+					sizeof(struct hrec))))
 				{
-					clock_gettime(CLOCK_REALTIME,&tm);
-					localtime_r(&tm.tv_sec,&stm);
-					strftime(datim,sizeof(datim),"%T",&stm);
-					sprintf(datim+8,".%09lu ",tm.tv_nsec);
+					perror("realloc");
+					free(r);
+					free(m);
+					return 1;
 				}
-				else *datim=0;
-				printf(" %s%llu %llu %llu%s",datim,
-					(unsigned long long)min,
-					(unsigned long long)(sum/n),
-					(unsigned long long)max,
-					chg||cont?"\n":"        \r");
-				if(!chg&&!cont)fflush(stdout);
-				chg=0;
+				m=tmp;
+				m[total++]=r[j];
 			}
+			else histsum(&m[k].st,&r[j].st);
+			snprintf(m[k].info,sizeof(m[k].info),
+				"merged from %d files",argc-1);
 		}
-
-skip:		if(dly)usleep(dly);
+		free(r);
 	}
+
+	res=histwrite(argv[0],m,total);
+	free(m);
+	return res?1:0;
 }
 
-static void udpresponder(int us)
+/* two sample Kolmogorov-Smirnov test on the shared bucket layout */
+static double kstest(struct stats *a,struct stats *b,double *dmax)
 {
-	int l;
-	socklen_t sl;
-	struct pollfd p;
-	struct sockaddr_storage ss;
-	struct sockaddr_in *s4=(struct sockaddr_in *)&ss;
-	struct sockaddr_in6 *s6=(struct sockaddr_in6 *)&ss;
-	struct sockaddr_in tmp;
-	unsigned char bfr[DATASIZE];
+	int i;
+	int j;
+	uint64_t ca=0;
+	uint64_t cb=0;
+	double d;
+	double ne;
+	double lambda;
+	double term;
+	double p=0.0;
 
-	p.fd=us;
-	p.events=POLLIN|POLLHUP|POLLERR;
+	*dmax=0.0;
+	if(!a->n||!b->n)return 1.0;
 
-	memset(&tmp,0,sizeof(tmp));
-	tmp.sin_family=AF_INET;
+	for(i=0;i<HISTSIZE;i++)
+	{
+		ca+=a->hist[i];
+		cb+=b->hist[i];
+		d=fabs((double)ca/a->n-(double)cb/b->n);
+		if(d>*dmax)*dmax=d;
+	}
 
-	while(1)
+	ne=sqrt((double)a->n*b->n/(a->n+b->n));
+	lambda=(ne+0.12+0.11/ne)**dmax;
+	for(j=1;j<=100;j++)
 	{
-		if(poll(&p,1,-1)<1)continue;
-		if(p.revents&(POLLHUP|POLLERR))
-		{
-			fprintf(stderr,"socket error\n");
-			return;
-		}
-		if(!(p.revents&POLLIN))continue;
-		sl=sizeof(struct sockaddr_storage);
-		if((l=recvfrom(us,bfr,sizeof(bfr),MSG_DONTWAIT,
-			(struct sockaddr *)&ss,&sl))<=0)
-		{
-			if(l<0)perror("recvfrom");
-			else fprintf(stderr,"unspecified receive error\n");
-			return;
-		}
+		term=2.0*exp(-2.0*j*j*lambda*lambda);
+		p+=j&1?term:-term;
+		if(term<1e-12)break;
+	}
+	if(p<0.0)p=0.0;
+	if(p>1.0||j>100)p=1.0;
+	return p;
+}
 
-		if(l!=DATASIZE)
-		{
-			fprintf(stderr,"Warning: unexpected data length\n");
-			continue;
-		}
+static void cmpline(char *name,uint64_t a,uint64_t b)
+{
+	printf("  %-8s %12llu %12llu %+12lld",name,(unsigned long long)a,
+		(unsigned long long)b,(long long)(b-a));
+	if(a)printf(" (%+.1f%%)",((double)b-a)*100.0/a);
+	printf("\n");
+}
 
-		if(ss.ss_family==AF_INET6)if(!memcmp(s6->sin6_addr.s6_addr,
-			"\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\xff\xff",12))
+static int histcmp(int argc,char *argv[])
+{
+	int i;
+	int j;
+	int na;
+	int nb;
+	int k;
+	int res=0;
+	double p;
+	double d;
+	struct hrec *a;
+	struct hrec *b;
+	static double pct[]={50.0,90.0,99.0,99.9,99.99,0.0};
+	char name[16];
+
+	if(argc!=2)usage();
+	if(!(a=histread(argv[0],&na)))return 1;
+	if(!(b=histread(argv[1],&nb)))
+	{
+		free(a);
+		return 1;
+	}
+
+	for(i=0;i<na;i++)for(j=0;j<nb;j++)if(!strcmp(a[i].name,b[j].name))
+	{
+		printf("%s: %llu vs %llu samples, %llu vs %llu lost\n",
+			a[i].name,(unsigned long long)a[i].st.n,
+			(unsigned long long)b[j].st.n,
+			(unsigned long long)a[i].st.lost,
+			(unsigned long long)b[j].st.lost);
+		if(!a[i].st.n||!b[j].st.n)break;
+		printf("  %-8s %12s %12s %12s\n","","base","new","delta");
+		cmpline("min",a[i].st.min,b[j].st.min);
+		cmpline("avg",a[i].st.sum/a[i].st.n,b[j].st.sum/b[j].st.n);
+		for(k=0;pct[k]!=0.0;k++)
 		{
-			memcpy(&tmp.sin_addr.s_addr,s6->sin6_addr.s6_addr+12,4);
-			tmp.sin_port=s6->sin6_port;
-			*s4=tmp;
+			sprintf(name,"%g%%",pct[k]);
+			cmpline(name,statpct(&a[i].st,pct[k]),
+				statpct(&b[j].st,pct[k]));
 		}
-
-		if((l=sendto(us,bfr,sizeof(bfr),MSG_DONTWAIT,
-			(struct sockaddr *)&ss,sizeof(ss)))!=sizeof(bfr))
+		cmpline("max",a[i].st.max,b[j].st.max);
+		p=kstest(&a[i].st,&b[j].st,&d);
+		printf("  KS D=%.4f p=%.3g, ",d,p);
+		if(p>=0.01)printf("no significant shift\n");
+		else if(statpct(&b[j].st,50.0)>statpct(&a[i].st,50.0))
 		{
-			if(l<0)perror("Warning: sendto");
-			else fprintf(stderr,"Warning: unspecified sendto "
-				"error\n");
+			printf("significant shift upwards\n");
+			res=2;
 		}
+		else printf("significant shift downwards\n");
+		break;
 	}
+
+	free(a);
+	free(b);
+	return res;
 }
 
-static int mac2bin(char *mac,unsigned char *hwaddr)
+/* runs count probes through one variant and prints its cost, the
+   running output of the variant is discarded */
+static void benchrun(char *name,int (*fn)(void *arg),void *arg,int count,
+	struct stats *st)
 {
-	int i;
+	int out;
+	int nul;
+	struct timespec c0;
+	struct timespec c1;
 
-	for(i=0;i<ETH_ALEN;i++,mac+=3,hwaddr++)
+	statinit(st);
+	stop=0;
+	limit=count;
+
+	fflush(stdout);
+	out=dup(1);
+	if((nul=open("/dev/null",O_WRONLY|O_CLOEXEC))!=-1)
 	{
-		switch(i)
-		{
-		case ETH_ALEN-1:
-			if(mac[2])return -1;
-			break;
-		default:if(mac[2]!=':')return -1;
-			break;
-		}
-		if(mac[0]>='0'&&mac[0]<='9')*hwaddr=mac[0]-'0';
-		else if(mac[0]>='A'&&mac[0]<='F')*hwaddr=mac[0]-'A'+10;
-		else if(mac[0]>='a'&&mac[0]<='f')*hwaddr=mac[0]-'a'+10;
-		else return -1;
-		*hwaddr<<=4;
-		if(mac[1]>='0'&&mac[1]<='9')*hwaddr|=mac[1]-'0';
-		else if(mac[1]>='A'&&mac[1]<='F')*hwaddr|=mac[1]-'A'+10;
-		else if(mac[1]>='a'&&mac[1]<='f')*hwaddr|=mac[1]-'a'+10;
-		else return -1;
+		dup2(nul,1);
+		close(nul);
 	}
-	return 0;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID,&c0);
+	nul=fn(arg);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID,&c1);
+	fflush(stdout);
+	if(out!=-1)
+	{
+		dup2(out,1);
+		close(out);
+	}
+
+	if(nul||!st->n)printf("%-24s failed\n",name);
+	else printf("%-24s %8llu ns cpu/probe %8llu ns roundtrip %8llu ns "
+		"99%%\n",name,
+		(unsigned long long)((tsns(&c1)-tsns(&c0))/(st->n+20)),
+		(unsigned long long)(st->sum/st->n),
+		(unsigned long long)statpct(st,99.0));
 }
 
-static int getmac(char *dev,unsigned char *addr)
+struct benchudp
 {
-	int s;
-	struct ifreq ifreq;
+	int us;
+	int idx;
+	struct txsched sched;
+	struct stats *st;
+};
 
-	if((s=socket(AF_INET,SOCK_DGRAM,0))==-1)return -1;
-	memset(&ifreq,0,sizeof(ifreq));
-	strncpy(ifreq.ifr_name,dev,sizeof(ifreq.ifr_name)-1);
-	if(ioctl(s,SIOCGIFHWADDR,&ifreq))
+struct benchl2
+{
+	struct rxtx *tx;
+	struct rxtx *rx;
+	int idx;
+	struct stats *st;
+	unsigned char mac[ETH_ALEN];
+};
+
+static int benchudp(void *arg)
+{
+	struct benchudp *b=arg;
+
+	memset(&b->sched,0,sizeof(b->sched));
+	b->sched.lead=1000;
+	b->sched.local=1;
+	return udpinit[b->idx](b->us,0,NULL,&b->sched,0,0,0,b->st);
+}
+
+static int benchl2(void *arg)
+{
+	struct benchl2 *b=arg;
+
+	return l2init[b->idx](b->tx,b->rx,b->mac,b->mac,b->idx&8?1:0,0,0,0,0,
+		b->st);
+}
+
+/* runs the layer 2 variants selected by mask over lo with the given
+   rings, returns -1 if lo cannot be accessed */
+static int benchlo(struct geom *rxg,struct geom *txg,int mask,char *sfx,
+	int show,int count,struct stats *st)
+{
+	int i;
+	char name[32];
+	struct benchl2 bl;
+
+	if(!(bl.tx=txopen("lo",DATASIZE,txg)))return -1;
+	if(!(bl.rx=rxopen("lo",ETH_P_802_EX1,0,rxg)))
 	{
-		close(s);
+		txclose(bl.tx);
 		return -1;
 	}
-	close(s);
-	if(ifreq.ifr_hwaddr.sa_family!=ARPHRD_ETHER)return -1;
-	memcpy(addr,ifreq.ifr_hwaddr.sa_data,ETH_ALEN);
+	if(show)
+	{
+		fflush(stdout);
+		geomshow("tx",bl.tx);
+		geomshow("rx",bl.rx);
+	}
+
+	memset(bl.mac,0,ETH_ALEN);
+	bl.st=st;
+	for(i=0;i<16;i++)if(!(i&~mask))
+	{
+		bl.idx=i;
+		snprintf(name,sizeof(name),"layer2%s%s%s%s",i&8?"+vlan":"",
+			i&4?"+fast":"",i&1?"+inst":"",sfx);
+		benchrun(name,benchl2,&bl,count,st);
+	}
+
+	rxclose(bl.rx);
+	txclose(bl.tx);
 	return 0;
 }
 
-static int getaddr(char *addr,struct sockaddr_storage *dest,int v4)
+/* the variants without a probe interval are measured, the unix datagram
+   baseline stands in for UDP and layer 2 frames loop back through lo,
+   instrumented variants run with capture and transmit stamps off to
+   show the cost of their checks alone, every geometry repeats the
+   layer 2 variants without vlan with its rings */
+static int bench(int argc,char *argv[])
 {
-	int e;
-	struct hostent r;
-	struct hostent *res;
-	struct sockaddr_in *a4=(struct sockaddr_in *)dest;
-	struct sockaddr_in6 *a6=(struct sockaddr_in6 *)dest;
-	char bfr[8192];
+	int i;
+	int sp[2];
+	int count=100000;
+	pid_t pid;
+	char name[32];
+	struct stats st;
+	struct benchudp bu;
+	struct geom txg={TXRING,0,RXTXBUF};
+	struct geom rxg={RXRING,0,RXTXBUF};
+	struct geom tx;
+	struct geom rx;
 
-	memset(dest,0,sizeof(struct sockaddr_storage));
+	if(argc&&((count=atoi(argv[0]))<1000||count>10000000))usage();
+	for(i=1;i<argc;i++)if(getgeom(argv[i],&rx,&tx))usage();
 
-	if(inet_pton(AF_INET,addr,&a4->sin_addr.s_addr)==1)goto chk4;
-	if(!v4)if(inet_pton(AF_INET6,addr,a6->sin6_addr.s6_addr)==1)goto chk6;
-	if(!v4)if(!gethostbyname2_r(addr,AF_INET6,&r,bfr,sizeof(bfr),&res,&e))
-		if(r.h_addrtype==AF_INET6)
+	if(socketpair(AF_UNIX,SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC,0,sp))
 	{
-		memcpy(a6->sin6_addr.s6_addr,r.h_addr,16);
-		goto chk6;
+		perror("socketpair");
+		return 1;
 	}
-	if(!gethostbyname2_r(addr,AF_INET,&r,bfr,sizeof(bfr),&res,&e))
-		if(r.h_addrtype==AF_INET)
+	switch((pid=fork()))
 	{
-		memcpy(&a4->sin_addr.s_addr,r.h_addr,4);
-		goto chk4;
+	case -1:perror("fork");
+		return 1;
+	case 0:	prctl(PR_SET_PDEATHSIG,SIGKILL);
+		close(sp[0]);
+		unixresponder(sp[1]);
+		_exit(1);
 	}
-	return -1;
-
-chk4:	if(!memcmp(&a4->sin_addr.s_addr,"\x00\x00\x00\x00",4))return -1;
-	if(be32toh(a4->sin_addr.s_addr)>=0xe0000000)return -1;
-	a4->sin_family=AF_INET;
-	return 0;
+	close(sp[1]);
 
-chk6:	if(memcmp(a6->sin6_addr.s6_addr,"\xfe\x80\x00\x00\x00\x00\x00\x00",8)&&
-		(a6->sin6_addr.s6_addr[0]&0xfe)!=0xfc&&
-		(a6->sin6_addr.s6_addr[0]&0xe0)!=0x20)return -1;
-	a6->sin6_family=AF_INET6;
-	return 0;
-}
+	bu.us=sp[0];
+	bu.st=&st;
+	for(i=0;i<8;i++)if(!(i&2))
+	{
+		bu.idx=i;
+		sprintf(name,"unix%s%s",i&4?"+txtime":"",i&1?"+inst":"");
+		benchrun(name,benchudp,&bu,count,&st);
+	}
 
-static int chkaddr(struct sockaddr_storage *ss,int local)
-{
-	if(ss->ss_family!=AF_INET6)return 0;
-	if(((struct sockaddr_in6 *)ss)->sin6_addr.s6_addr[0]==0xfe)
+	kill(pid,SIGKILL);
+	waitpid(pid,NULL,0);
+	close(sp[0]);
+
+	if(benchlo(&rxg,&txg,0xd,"",0,count,&st))goto l2err;
+
+	for(i=1;i<argc;i++)
 	{
-		if(!local)return -1;
+		rx=rxg;
+		tx=txg;
+		getgeom(argv[i],&rx,&tx);
+		printf("geometry %d: %s\n",i,argv[i]);
+		sprintf(name," g%d",i);
+		if(benchlo(&rx,&tx,0x5,name,1,count,&st))goto l2err;
 	}
-	else if(local)return -1;
 	return 0;
-}
 
-static void usage(void)
-{
-	fprintf(stderr,"Usage:\n\n"
-	"netdelay [<options>] -R -i <netdevice>\n"
-	"netdelay [<options>] -I -i <netdevice> -d <destination-mac>\n"
-	"netdelay [<options>] -R -u|-U -P <port>\n"
-	"netdelay [<options>] -I -u|-U -h <destination-address> -P <port>\n\n"
-	"-I initiator mode\n"
-	"-R responder mode\n"
-	"-u use UDP instead of layer 2\n"
-	"-U use UDPLITE instead of layer 2\n"
-	"-4 force IPv4 for UDP/UDPLITE\n"
-	"-w <time> time to wait between tests in ms (0-100, default 50)\n"
-	"-b <value> set busy poll (1-500)\n"
-	"-i <netdevice> network device to use\n"
-	"-d <destination-mac> ethernet address of responder\n"
-	"-h <destination-host> UDP/UDPLITE destination host\n"
-	"-P <port> UDP/UDPLITE local and remote port (1-65535)\n"
-	"-D <value> set DSCP value for UDP/UDPLITE (1-63)\n"
-	"-r <value> set realtime priority (1-99)\n"
-	"-c <value> set core to run on (0-1023)\n"
-	"-v <value> set 802.1q vlan (1-4094)\n"
-	"-p <value> set 802.1p priority (1-7)\n"
-	"-l <value> set system latency via /dev/cpu_dma_latency (0-9999)\n\n"
-	"-F don't sleep on ENOBUFS in layer2 mode, retry instantly\n"
-	"-m lock process memory\n"
-	"-t print timestamp\n"
-	"-C new line only if minimum or maximum value has changed\n"
-	"If UDP/UDPLITE is used specifying a network device disables IPv4\n"
-	"routing and requires an IPv6 link local address.\n\n"
-	"This tool measures network roundtrip delay with layer 2 packets\n"
-	"bypassing the kernel network stack.\n\n"
-	"The output is 3 columns, all in nanoseconds:\n\n"
-	"minimum-delay average-delay maximum-delay\n");
-	exit(1);
+l2err:	printf("layer 2 variants skipped, lo needs CAP_NET_RAW\n");
+	return 0;
 }
 
 int main(int argc,char *argv[])
@@ -889,18 +4798,90 @@ int main(int argc,char *argv[])
 	int dly=50;
 	int cont=1;
 	int fast=0;
+	int ncls=0;
+	int i;
+	int cls[MAXCLASS];
+	int cs[MAXCLASS];
+	int lrate=-1;
+	int lsize=1472;
+	int lcpu=-1;
+	int rcpu=-1;
+	int autop=0;
+	int qack=0;
+	int ipc=0;
+	int sp[2];
+	int dur=0;
+	int json=0;
+	int nslo=0;
+	int res=0;
+	int sres[MAXSESS];
+	int nresp=0;
+	int nflow=0;
+	int lead=0;
+	int local=0;
+	int txts=0;
+	int txflags;
+	int rperiod=-1;
+	int one=1;
+	int huge=0;
+	int geo=0;
+	size_t rsize=0;
+	char *trace=NULL;
+	char *sfile=NULL;
+	int nport=0;
+	struct stats *sst=NULL;
+	struct stats *stp;
+	struct replay *rp=NULL;
+	int qs[MAXFLOW];
+	int nst;
+	uint64_t thresh=0;
+	uint64_t bound=0;
 	char *host=NULL;
+	char *capfile=NULL;
+	char *histfile=NULL;
+	char *group=NULL;
+	char *pdev=NULL;
 	char *dev=NULL;
 	char *dmac=NULL;
 	struct rxtx *tx=NULL;
 	struct rxtx *rx=NULL;
 	struct sched_param prm;
 	cpu_set_t core;
+	cpu_set_t all;
+	cpu_set_t peer;
+	pthread_t ltid;
+	pthread_t rtid;
+	pthread_attr_t attr;
+	struct load ld;
+	struct shm *shm=NULL;
+	sigset_t set;
+	sigset_t oset;
+	struct sigaction sa;
+	struct slo slo[MAXSLO];
+	struct stats st[MAXSTATS];
+	struct hrec *hr;
+	struct txsched sched;
+	struct sock_txtime stt;
+	struct txstamp txs;
+	struct rstat rs;
+	struct geom rxg={RXRING,0,RXTXBUF};
+	struct geom txg={TXRING,0,RXTXBUF};
+	struct geom lg={LOADRING,0,RXTXBUF};
 	struct sockaddr_storage ss;
+	struct sockaddr_storage resp[MAXRESP];
 	unsigned char src[ETH_ALEN];
 	unsigned char dst[ETH_ALEN];
+	char id[32];
+	char nic[IFNAMSIZ];
+	static char *mname[]={"layer2","udp","udplite","tcp"};
+	static char *bname[]={"clock","shm","unix"};
 
-	while((c=getopt(argc,argv,"IRi:d:r:c:p:l:h:P:uUD:4b:mtw:CF"))!=-1)
+	if(argc>1&&!strcmp(argv[1],"merge"))return histmerge(argc-2,argv+2);
+	if(argc>1&&!strcmp(argv[1],"compare"))return histcmp(argc-2,argv+2);
+	if(argc>1&&!strcmp(argv[1],"bench"))return bench(argc-2,argv+2);
+
+	while((c=getopt(argc,argv,"IRB:i:d:r:c:p:l:h:P:uUTQD:4b:mtw:CFM:L:S:"
+		"k:x:X:n:N:jA:s:o:O:HG:f:aq:e:gyE:K:Y:Z:z:"))!=-1)
 		switch(c)
 	{
 	case 'I':
@@ -911,6 +4892,13 @@ int main(int argc,char *argv[])
 		mode=1;
 		break;
 
+	case 'B':
+		if(!strcmp(optarg,"clock"))ipc=1;
+		else if(!strcmp(optarg,"shm"))ipc=2;
+		else if(!strcmp(optarg,"unix"))ipc=3;
+		else usage();
+		break;
+
 	case 'i':
 		dev=optarg;
 		if(getmac(dev,src))usage();
@@ -957,6 +4945,14 @@ int main(int argc,char *argv[])
 		udp=2;
 		break;
 
+	case 'T':
+		udp=3;
+		break;
+
+	case 'Q':
+		qack=1;
+		break;
+
 	case 'D':
 		if((dscp=atoi(optarg))<1||dscp>63)usage();
 		break;
@@ -989,10 +4985,130 @@ int main(int argc,char *argv[])
 		fast=1;
 		break;
 
+	case 'M':
+		if((ncls=getcls(optarg,cls))<1)usage();
+		break;
+
+	case 'L':
+		if((lrate=atoi(optarg))<0||lrate>10000000)usage();
+		break;
+
+	case 'S':
+		if((lsize=atoi(optarg))<64||lsize>1472)usage();
+		break;
+
+	case 'k':
+		if((lcpu=atoi(optarg))<0||lcpu>1023)usage();
+		break;
+
+	case 'x':
+		capfile=optarg;
+		break;
+
+	case 'X':
+		if((thresh=strtoull(optarg,NULL,10))<1||thresh>=1000000000)
+			usage();
+		break;
+
+	case 'n':
+		if(!(limit=strtoull(optarg,NULL,10)))usage();
+		break;
+
+	case 'N':
+		if((dur=atoi(optarg))<1)usage();
+		break;
+
+	case 'j':
+		json=1;
+		break;
+
+	case 'o':
+		histfile=optarg;
+		break;
+
+	case 'O':
+		if((rcpu=atoi(optarg))<0||rcpu>1023)usage();
+		break;
+
+	case 'G':
+		group=optarg;
+		break;
+
+	case 'f':
+		if((nresp=atoi(optarg))<1||nresp>MAXRESP)usage();
+		break;
+
+	case 'a':
+		autop=1;
+		break;
+
+	case 'q':
+		if((nflow=atoi(optarg))<1||nflow>MAXFLOW)usage();
+		break;
+
+	case 'e':
+		if((lead=atoi(optarg))<1||lead>100000)usage();
+		break;
+
+	case 'g':
+		local=1;
+		break;
+
+	case 'y':
+		txts=1;
+		break;
+
+	case 'E':
+		if((rperiod=atoi(optarg))<0||rperiod>3600)usage();
+		break;
+
+	case 'Y':
+		trace=optarg;
+		break;
+
+	case 'Z':
+		sfile=optarg;
+		break;
+
+	case 'z':
+		if((nport=atoi(optarg))<1||nport>MAXFLOW)usage();
+		break;
+
+	case 'K':
+		if(getgeom(optarg,&rxg,&txg))usage();
+		geo=1;
+		break;
+
+	case 'H':
+		huge=1;
+		break;
+
+	case 'A':
+		if((bound=strtoull(optarg,NULL,10))<1||bound>=1000000000)
+			usage();
+		break;
+
+	case 's':
+		if(nslo==MAXSLO||getslo(optarg,&slo[nslo++]))usage();
+		break;
+
 	default:usage();
 	}
 
-	if(udp)
+	if(ipc)
+	{
+		if(mode||udp||dev||dmac)usage();
+	}
+	else if(group)
+	{
+		if(!udp||udp==3||host||!port||(mode==2)!=(nresp!=0))usage();
+		if(!mode||getgroup(group,&ss,v4,dev?1:0))usage();
+	}
+	else if(sfile)
+	{
+		if(mode!=2||!udp||udp==3||host||port)usage();
+	}
+	else if(udp)
 	{
 		ss.ss_family=(v4?AF_INET:AF_INET6);
 		switch(mode)
@@ -1013,12 +5129,148 @@ int main(int argc,char *argv[])
 		}
 	}
 
+	if(ncls)
+	{
+		if(mode!=2||prio||dscp||udp==3)usage();
+		if(udp&&port+ncls>65536)usage();
+		if(!udp)for(i=0;i<ncls;i++)if(cls[i]>7)usage();
+	}
+
+	if(nresp&&!group)usage();
+	if(group&&(ncls||lrate!=-1||capfile))usage();
+	if(nflow&&(mode!=2||!udp||udp==3||ncls||group||capfile||
+		port+nflow>65536))usage();
+	if(lead&&(mode!=2||!udp||udp==3||ncls||group||nflow))usage();
+	if(local&&!lead)usage();
+	if(txts&&(mode!=2||udp==3||ncls||group||nflow||local))usage();
+	if(rperiod!=-1&&(mode!=1||udp==3))usage();
+	if(geo&&(udp||ipc))usage();
+	if(trace&&(mode!=2||udp==3||ncls||group||nflow||lead||txts||
+		capfile))usage();
+	if(sfile&&(ncls||nflow||lead||txts||trace||capfile||lrate!=-1||
+		rcpu!=-1))usage();
+	if(nport&&(mode!=1||!udp||udp==3||group||port+nport>65536))usage();
+	if(huge&&rcpu==-1)usage();
+	nst=ncls?ncls:nresp?nresp+1:1;
+	for(i=0;i<ncls;i++)sprintf(label[i],"%d",cls[i]);
+	if(nresp)strcpy(label[0],"last");
+	for(i=1;i<=nresp;i++)sprintf(label[i],"%d",i);
+
+	if(lrate!=-1&&mode!=2)usage();
+	if(qack&&udp!=3)usage();
+	if(capfile&&(mode!=2||udp==3))usage();
+	if(thresh&&!capfile)usage();
+	if(autop&&ipc)usage();
+	if((limit||json||bound||nslo||histfile)&&mode!=2&&!ipc)usage();
+	if(rcpu!=-1&&((mode!=2&&!ipc)||capfile))usage();
+
+	if(!ipc&&(autop||cpu!=-1))
+	{
+		if(dev)pdev=dev;
+		else if(mode==2&&!sfile&&!routedev(&ss,nic))pdev=nic;
+		if(!pdev)
+		{
+			if(autop)fprintf(stderr,"Warning: cannot determine the "
+				"network device for placement\n");
+		}
+		else if(placement(pdev,autop,&cpu,&lcpu,rcpu,lrate!=-1))
+		{
+			perror("sched_getaffinity");
+			return 1;
+		}
+	}
+
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler=sigstop;
+	sigemptyset(&sa.sa_mask);
+	if(sigaction(SIGINT,&sa,NULL)||sigaction(SIGTERM,&sa,NULL)||
+		sigaction(SIGALRM,&sa,NULL))
+	{
+		perror("sigaction");
+		return 1;
+	}
+
+	if(rperiod!=-1||sfile)
+	{
+		if(rperiod!=-1)
+		{
+			memset(&rs,0,sizeof(rs));
+			statinit(&rs.turn);
+			rs.period=rperiod*1000000000ULL;
+			rst=&rs;
+		}
+		sa.sa_handler=sigdump;
+		if(sigaction(SIGUSR1,&sa,NULL))
+		{
+			perror("sigaction");
+			return 1;
+		}
+	}
+
+	for(i=0;i<MAXSTATS;i++)statinit(&st[i]);
+
+	memset(&sched,0,sizeof(sched));
+	sched.lead=lead*1000ULL;
+	sched.period=dly*1000000ULL;
+	sched.local=local;
+
+	if(txts)
+	{
+		memset(&txs,0,sizeof(txs));
+		for(i=0;i<3;i++)statinit(&txs.st[i]);
+		tstx=&txs;
+	}
+	if(udp)txflags=SOF_TIMESTAMPING_TX_SCHED|SOF_TIMESTAMPING_TX_SOFTWARE|
+		SOF_TIMESTAMPING_TX_HARDWARE|SOF_TIMESTAMPING_SOFTWARE|
+		SOF_TIMESTAMPING_RAW_HARDWARE|SOF_TIMESTAMPING_OPT_ID|
+		SOF_TIMESTAMPING_OPT_TSONLY;
+	else txflags=SOF_TIMESTAMPING_SOFTWARE|SOF_TIMESTAMPING_RAW_HARDWARE;
+	stt.clockid=CLOCK_TAI;
+	stt.flags=0;
+
+	/* the local launch wait must not be extended by timer slack */
+	if(local||trace)if(prctl(PR_SET_TIMERSLACK,1))
+	{
+		perror("prctl");
+		return 1;
+	}
+	memset(resp,0,sizeof(resp));
+
+	if(trace)
+	{
+		if(!(rp=calloc(1,sizeof(struct replay))))
+		{
+			perror("calloc");
+			return 1;
+		}
+		if(!(rp->pkt=traceload(trace,&rp->n)))return 1;
+		/* warm-up goes by sequence number as replies may be lost,
+		   reports are more frequent as traces are often sparse */
+		rp->st=st;
+		rp->m.ts=ts;
+		rp->m.cont=cont;
+		rp->m.mask=0xff;
+	}
+
+	if(capfile)if(!(cap=capopen(capfile,dev,udp,&ss,(dscp<<2)&0xfc,
+		thresh)))
+	{
+		fprintf(stderr,"Cannot create %s\n",capfile);
+		return 1;
+	}
+
 	if(mla)if(mlockall(MCL_CURRENT|MCL_FUTURE))
 	{
 		perror("mlockall");
 		return 1;
 	}
 
+	if(sched_getaffinity(0,sizeof(cpu_set_t),&all))
+	{
+		perror("sched_getaffinity");
+		return 1;
+	}
+
 	if(cpu!=-1)
 	{
 		CPU_ZERO(&core);
@@ -1030,19 +5282,220 @@ int main(int argc,char *argv[])
 		}
 	}
 
-	if(udp)
+	/* keep the load and baseline peer off the measurement core unless
+	   told otherwise */
+	if(lcpu!=-1)
+	{
+		CPU_ZERO(&peer);
+		CPU_SET(lcpu,&peer);
+	}
+	else
+	{
+		peer=all;
+		if(cpu!=-1)CPU_CLR(cpu,&peer);
+		if(!CPU_COUNT(&peer))peer=all;
+	}
+
+	if(ipc)
+	{
+		if(ipc==2)
+		{
+			if((shm=mmap(NULL,sizeof(struct shm),
+				PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,
+				-1,0))==MAP_FAILED)goto ipcerr;
+			memset(shm,0,sizeof(struct shm));
+		}
+		else if(ipc==3)
+		{
+			if(socketpair(AF_UNIX,SOCK_DGRAM|SOCK_NONBLOCK|
+				SOCK_CLOEXEC,0,sp))goto ipcerr;
+			us=sp[0];
+		}
+
+		if(ipc>1)switch(fork())
+		{
+		case -1:
+ipcerr:			perror("baseline setup");
+			return 1;
+
+		case 0:	prctl(PR_SET_PDEATHSIG,SIGKILL);
+			if(sched_setaffinity(0,sizeof(cpu_set_t),&peer))
+			{
+				perror("sched_setaffinity");
+				_exit(1);
+			}
+			prm.sched_priority=rt;
+			if(rt)if(sched_setscheduler(0,SCHED_RR,&prm))
+			{
+				perror("sched_setscheduler");
+				_exit(1);
+			}
+			if(ipc==2)shmresponder(shm);
+			else
+			{
+				close(sp[0]);
+				unixresponder(sp[1]);
+			}
+			_exit(1);
+		}
+
+		if(ipc==3)close(sp[1]);
+	}
+	else if(udp&&ncls)
+	{
+		for(i=0;i<ncls;i++)
+			if((cs[i]=mksock(ss.ss_family,udp-1,port+i,dev,cls[i],
+				prio,cpu,bpoll))==-1)
+		{
+			while(i--)close(cs[i]);
+			goto userr;
+		}
+	}
+	else if(sfile)
+	{
+		if(!(sst=malloc(MAXSESS*sizeof(struct stats))))goto userr;
+		if(sessload(sfile,v4,dev,udp,dscp,prio,cpu,bpoll,dly,sst)<0)
+			return 1;
+	}
+	else if(nflow||nport)
+	{
+		for(i=0;i<nflow+nport;i++)
+			if((qs[i]=mksock(ss.ss_family,udp-1,port+i,dev,dscp,
+				prio,cpu,bpoll))==-1||(rst&&setsockopt(qs[i],
+				SOL_SOCKET,SO_TIMESTAMPNS,&one,sizeof(one))))
+		{
+			while(i--)close(qs[i]);
+			goto userr;
+		}
+	}
+	else if(udp)
 	{
-		us=mksock(ss.ss_family,udp-1,port,dev,dscp,prio,cpu,bpoll);
+		/* the TCP initiator connects from an ephemeral port */
+		if((us=mksock(ss.ss_family,udp-1,udp==3&&mode==2?0:port,dev,
+			dscp,prio,cpu,bpoll))==-1||
+			(udp==3&&mode==1&&listen(us,1))||
+			(group&&mcsetup(us,&ss,dev,mode==1))||
+			(lead&&!local&&setsockopt(us,SOL_SOCKET,SO_TXTIME,&stt,
+				sizeof(stt)))||
+			(txts&&setsockopt(us,SOL_SOCKET,SO_TIMESTAMPING,&txflags,
+				sizeof(txflags)))||
+			(rst&&setsockopt(us,SOL_SOCKET,SO_TIMESTAMPNS,&one,
+				sizeof(one))))
+		{
+userr:			perror("socket");
+			return 1;
+		}
 	}
 	else
 	{
-		if(!(tx=txopen(dev)))goto txerr;
-		if(!(rx=rxopen(dev,ETH_P_802_EX1,bpoll)))
+		if(!(tx=txopen(dev,trace?ETH_FRAME_LEN+4:DATASIZE,&txg)))
+			goto txerr;
+		if((txts&&setsockopt(tx->fd,SOL_PACKET,PACKET_TIMESTAMP,
+			&txflags,sizeof(txflags)))||
+			!(rx=rxopen(dev,ETH_P_802_EX1,bpoll,&rxg)))
 		{
 			txclose(tx);
 txerr:			fprintf(stderr,"Cannot access %s\n",dev);
 			return 1;
 		}
+		if(geo)
+		{
+			geomshow("tx",tx);
+			geomshow("rx",rx);
+		}
+	}
+
+	if(lrate!=-1)
+	{
+		memset(&ld,0,sizeof(ld));
+		ld.us=-1;
+		ld.rate=lrate;
+		ld.size=lsize;
+		if(udp)
+		{
+			ld.ss=ss;
+			if(ss.ss_family==AF_INET)((struct sockaddr_in *)&ld.ss)->
+				sin_port=htobe16(LOADPORT);
+			else ((struct sockaddr_in6 *)&ld.ss)->sin6_port=
+				htobe16(LOADPORT);
+			if((ld.us=mksock(ss.ss_family,udp==3?0:udp-1,0,dev,0,0,
+				-1,0))==-1)
+				goto lderr;
+		}
+		else
+		{
+			memcpy(ld.src,src,ETH_ALEN);
+			memcpy(ld.dst,dst,ETH_ALEN);
+			ld.tag=(prio||ncls);
+			ld.vid=vid;
+			if(!(ld.tx=txopen(dev,lsize,&lg)))goto lderr;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC,&ld.last);
+		lgen=&ld;
+
+		/* termination signals belong to the measurement thread */
+		sigemptyset(&set);
+		sigaddset(&set,SIGINT);
+		sigaddset(&set,SIGTERM);
+		sigaddset(&set,SIGALRM);
+		if(pthread_attr_init(&attr))goto lderr;
+		pthread_sigmask(SIG_BLOCK,&set,&oset);
+		if(pthread_attr_setaffinity_np(&attr,sizeof(cpu_set_t),&peer)||
+			pthread_create(&ltid,&attr,udp?udpload:l2load,&ld))
+		{
+			pthread_sigmask(SIG_SETMASK,&oset,NULL);
+			pthread_attr_destroy(&attr);
+lderr:			fprintf(stderr,"Cannot start load generator\n");
+			return 1;
+		}
+		pthread_sigmask(SIG_SETMASK,&oset,NULL);
+		pthread_attr_destroy(&attr);
+	}
+
+	if(rcpu!=-1)
+	{
+		/* the sample ring spans several hundred 4k pages */
+		rsize=sizeof(struct report);
+		rep=MAP_FAILED;
+		if(huge)
+		{
+			rsize=(rsize+HUGEPAGE-1)&~(HUGEPAGE-1);
+			if((rep=mmap(NULL,rsize,PROT_READ|PROT_WRITE,
+				MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|
+				MAP_POPULATE,-1,0))==MAP_FAILED)
+			{
+				perror("Warning: huge pages");
+				rsize=sizeof(struct report);
+			}
+		}
+		if(rep==MAP_FAILED&&(rep=mmap(NULL,rsize,PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS,-1,0))==MAP_FAILED)
+		{
+			rep=NULL;
+			goto reperr;
+		}
+		rep->ts=ts;
+		rep->cont=cont;
+
+		CPU_ZERO(&core);
+		CPU_SET(rcpu,&core);
+		sigemptyset(&set);
+		sigaddset(&set,SIGINT);
+		sigaddset(&set,SIGTERM);
+		sigaddset(&set,SIGALRM);
+		if(pthread_attr_init(&attr))goto reperr;
+		pthread_sigmask(SIG_BLOCK,&set,&oset);
+		if(pthread_attr_setaffinity_np(&attr,sizeof(cpu_set_t),&core)||
+			pthread_create(&rtid,&attr,reporter,rep))
+		{
+			pthread_sigmask(SIG_SETMASK,&oset,NULL);
+			pthread_attr_destroy(&attr);
+reperr:			fprintf(stderr,"Cannot start reporter\n");
+			return 1;
+		}
+		pthread_sigmask(SIG_SETMASK,&oset,NULL);
+		pthread_attr_destroy(&attr);
 	}
 
 	if(rt)
@@ -1051,8 +5504,8 @@ txerr:			fprintf(stderr,"Cannot access %s\n",dev);
 		if(sched_setscheduler(0,SCHED_RR,&prm))
 		{
 			perror("sched_setscheduler");
-			rxclose(rx);
-			txclose(tx);
+			if(rx)rxclose(rx);
+			if(tx)txclose(tx);
 			return 1;
 		}
 	}
@@ -1062,36 +5515,150 @@ txerr:			fprintf(stderr,"Cannot access %s\n",dev);
 		if((fd=open("/dev/cpu_dma_latency",O_WRONLY|O_CLOEXEC))==-1)
 		{
 			perror("open");
-			rxclose(rx);
-			txclose(tx);
+			if(rx)rxclose(rx);
+			if(tx)txclose(tx);
 			return 1;
 		}
 		if(write(fd,&lat,sizeof(lat))!=sizeof(lat))
 		{
 			perror("write");
-			rxclose(rx);
-			txclose(tx);
+			if(rx)rxclose(rx);
+			if(tx)txclose(tx);
 			close(fd);
 			return 1;
 		}
 	}
 
-	if(udp)
+	if(dur)alarm(dur);
+
+	if(ipc==1)res=clkinitiator(ts,dly*1000,cont,st);
+	else if(ipc==2)res=shminitiator(shm,ts,dly*1000,cont,st);
+	else if(ipc==3)res=udpinitiator(us,0,NULL,NULL,ts,dly*1000,cont,
+		st);
+	else if(udp)
 	{
-		if(mode==2)udpinitiator(us,port,&ss,ts,dly*1000,cont);
-		else udpresponder(us);
+		if(udp==3)
+		{
+			if(mode==2)res=tcpinitiator(us,port,&ss,ts,dly*1000,
+				cont,qack,st);
+			else tcpresponder(us,qack);
+		}
+		else if(ncls)res=udpclsinitiator(cs,cls,ncls,port,&ss,ts,
+			dly*1000,cont,st);
+		else if(nflow)res=udpqinitiator(qs,nflow,port,&ss,ts,
+			dly*1000,cont,st);
+		else if(group&&mode==2)res=mcinitiator(us,port,&ss,nresp,resp,
+			ts,dly*1000,cont,st);
+		else if(trace)res=udpreplay(us,port,&ss,rp,dly*1000000);
+		else if(nsess)res=sessinitiator(sess,nsess,bpoll,ts,cont,st);
+		else if(mode==2)res=udpinitiator(us,port,&ss,lead?&sched:NULL,
+			ts,dly*1000,cont,st);
+		else udpresponder(nport?qs:&us,nport?nport:1,bpoll);
 	}
 	else
 	{
-		if(mode==2)l2initiator(tx,rx,src,dst,prio,vid,ts,dly*1000,cont,
-			fast);
+		if(ncls)res=l2clsinitiator(tx,rx,src,dst,cls,ncls,vid,ts,
+			dly*1000,cont,fast,st);
+		else if(trace)res=l2replay(tx,rx,src,dst,prio,vid,fast,rp,
+			dly*1000000);
+		else if(mode==2)res=l2initiator(tx,rx,src,dst,prio,vid,ts,
+			dly*1000,cont,fast,st);
 		else l2responder(rx,tx,prio,vid,fast);
 	}
 
+	if(rep)
+	{
+		__atomic_store_n(&rep->done,1,__ATOMIC_RELEASE);
+		pthread_join(rtid,NULL);
+		munmap(rep,rsize);
+		rep=NULL;
+	}
+
+	/* final responder statistics */
+	if(rst)
+	{
+		dump=1;
+		rstcheck(rst);
+	}
+
+	if(!cont)printf("\n");
+
+	if(mode==2||ipc)
+	{
+		stp=st;
+		if(nflow)
+		{
+			for(nst=0;nst<MAXSTATS&&*label[nst];nst++);
+			if(!nst)strcpy(label[nst++],"-");
+		}
+		else if(nsess)
+		{
+			sessprint(sess,nsess);
+			nst=nsess;
+			stp=sst;
+		}
+		for(i=0;i<nst;i++)if((sres[i]=slocheck(&stp[i],
+			ncls||nresp||nflow||nsess?stname(id,i,ncls,nresp,nflow):
+			NULL,bound,slo,nslo)))if(!res)res=1;
+		if(tstx)txprint(tstx);
+		if(json)jsonsum(ipc?bname[ipc-1]:mname[udp],dev,host,
+			group,port,dly*1000,prio,dscp,cls,ncls,nresp,resp,
+			nflow?nst:0,stp,bound,slo,nslo,sres,res<0);
+		if(histfile)
+		{
+			if(!(hr=malloc((nst+3)*sizeof(struct hrec))))res=-1;
+			else
+			{
+				for(i=0;i<nst;i++)
+				{
+					memset(hr[i].name,0,sizeof(hr[i].name));
+					memset(hr[i].info,0,sizeof(hr[i].info));
+					snprintf(hr[i].name,sizeof(hr[i].name),
+						"%s",stname(id,i,ncls,nresp,
+						nflow));
+					snprintf(hr[i].info,sizeof(hr[i].info),
+						"%s %s",ipc?bname[ipc-1]:
+						mname[udp],nsess?sess[i].name:
+						host?host:group?group:dev?dev:
+						"local");
+					hr[i].st=stp[i];
+				}
+				for(c=nst;tstx&&c<nst+3;c++)
+				{
+					memset(&hr[c],0,sizeof(struct hrec));
+					snprintf(hr[c].name,sizeof(hr[c].name),"tx %s",
+						txname[c-nst]);
+					strcpy(hr[c].info,hr[0].info);
+					hr[c].st=tstx->st[c-nst];
+				}
+				if(histwrite(histfile,hr,tstx?nst+3:nst))res=-1;
+				free(hr);
+			}
+		}
+	}
+
 	if(fd!=-1)close(fd);
 	if(us!=-1)close(us);
+	if(udp)for(i=0;i<ncls;i++)close(cs[i]);
+	for(i=0;i<nflow+nport;i++)close(qs[i]);
+	for(i=0;i<nsess;i++)close(sess[i].fd);
+	free(sess);
+	free(sst);
 	if(rx)rxclose(rx);
 	if(tx)txclose(tx);
+	if(shm)munmap(shm,sizeof(struct shm));
+	if(rp)
+	{
+		free(rp->pkt);
+		free(rp);
+	}
+	if(cap)
+	{
+		capflush(cap);
+		fclose(cap->fp);
+		free(cap);
+	}
 
-	return 1;
+	if(mode==1&&!stop)return 1;
+	return res<0?1:res?2:0;
 }